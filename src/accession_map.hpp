@@ -0,0 +1,802 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef ACCESSION_MAP_H
+#define ACCESSION_MAP_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include <cstdio>
+
+#if SEQAN_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace seqan;
+
+uint32_t const ACCESSION_NOT_FOUND      = std::numeric_limits<uint32_t>::max();
+// size of the blocks of lines the mapping files are read in
+uint32_t const MAPPING_BLOCK_SIZE       = 8 << 20;
+// accessions of an accession index are front coded in blocks of this many
+uint32_t const INDEX_BLOCK_SIZE         = 16;
+// mappings sorted in memory at once while an accession index is built
+uint32_t const INDEX_RUN_SIZE           = 1 << 25;
+char const     ACCESSION_INDEX_MAGIC[8] = {'S', 'L', 'A', '2', 'T', 'I', 'X', '1'};
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class accession_probe
+// ----------------------------------------------------------------------------
+// An open addressing hash set of the wanted accessions. Slots hold the
+// fingerprint of an accession and its index in the accessions vector, the
+// accession itself is only compared if the fingerprints match.
+class accession_probe
+{
+public:
+    explicit accession_probe(std::vector<std::string> const & accessions): _accessions(accessions)
+    {
+        size_t capacity = 1024;
+        while (capacity < accessions.size() * 2)
+            capacity *= 2;
+        _slot_fingerprints.resize(capacity, 0);
+        _slot_indices.resize(capacity, ACCESSION_NOT_FOUND);
+
+        size_t mask = capacity - 1;
+        for (uint32_t i = 0; i < accessions.size(); ++i)
+        {
+            uint64_t fingerprint = fingerprint_64(accessions[i].data(), accessions[i].size(), 0);
+            size_t slot = fingerprint & mask;
+            while (_slot_indices[slot] != ACCESSION_NOT_FOUND)
+                slot = (slot + 1) & mask;
+            _slot_fingerprints[slot] = fingerprint;
+            _slot_indices[slot] = i;
+        }
+    }
+
+    // the index of an accession or ACCESSION_NOT_FOUND
+    inline uint32_t find(char const * accession, size_t const accession_length) const
+    {
+        uint64_t fingerprint = fingerprint_64(accession, accession_length, 0);
+        size_t mask = _slot_indices.size() - 1;
+        for (size_t slot = fingerprint & mask; _slot_indices[slot] != ACCESSION_NOT_FOUND; slot = (slot + 1) & mask)
+        {
+            if (_slot_fingerprints[slot] != fingerprint)
+                continue;
+            std::string const & candidate = _accessions[_slot_indices[slot]];
+            if (candidate.size() == accession_length && std::memcmp(candidate.data(), accession, accession_length) == 0)
+                return _slot_indices[slot];
+        }
+        return ACCESSION_NOT_FOUND;
+    }
+
+private:
+    std::vector<std::string> const &    _accessions;
+    std::vector<uint64_t>               _slot_fingerprints;
+    std::vector<uint32_t>               _slot_indices;
+};
+
+// ----------------------------------------------------------------------------
+// Class line_block_reader
+// ----------------------------------------------------------------------------
+// Reads a plain or gzip compressed text file in blocks of whole lines.
+class line_block_reader
+{
+public:
+    line_block_reader() {}
+    line_block_reader(line_block_reader const &) = delete;
+    line_block_reader & operator=(line_block_reader const &) = delete;
+
+    ~line_block_reader()
+    {
+        close();
+    }
+
+    bool open(std::string const & file_path)
+    {
+        close();
+        _at_end = false;
+        _failed = false;
+        _rest.clear();
+#if SEQAN_HAS_ZLIB
+        // zlib reads uncompressed files as they are
+        _file = gzopen(file_path.c_str(), "rb");
+        if (_file == nullptr)
+            return false;
+        gzbuffer(_file, 1 << 20);
+        return true;
+#else
+        _file.open(file_path, std::ios::binary);
+        return _file.is_open();
+#endif
+    }
+
+    void close()
+    {
+#if SEQAN_HAS_ZLIB
+        if (_file != nullptr)
+            gzclose(_file);
+        _file = nullptr;
+#else
+        _file.close();
+#endif
+    }
+
+    // true if reading stopped on an error, e.g. a truncated or corrupt gzip file
+    bool failed() const
+    {
+        return _failed;
+    }
+
+    // the next block of about MAPPING_BLOCK_SIZE bytes ending after a '\n'
+    // returns false at the end of the file or on an error (see failed())
+    bool read(std::string & block)
+    {
+        block.swap(_rest);
+        _rest.clear();
+        if (_at_end)
+            return !block.empty();
+
+        size_t filled = block.size();
+        block.resize(filled + MAPPING_BLOCK_SIZE);
+#if SEQAN_HAS_ZLIB
+        int read_count = gzread(_file, &block[filled], MAPPING_BLOCK_SIZE);
+        size_t bytes_read = read_count > 0 ? read_count : 0;
+        // a truncated file ends with a short read and Z_BUF_ERROR, not with -1
+        int error_number = Z_OK;
+        if (bytes_read < MAPPING_BLOCK_SIZE)
+            gzerror(_file, &error_number);
+        _failed = read_count < 0 || error_number != Z_OK;
+#else
+        _file.read(&block[filled], MAPPING_BLOCK_SIZE);
+        size_t bytes_read = _file.gcount();
+        _failed = _file.bad();
+#endif
+        block.resize(filled + bytes_read);
+        if (_failed)
+        {
+            _at_end = true;
+            block.clear();
+            return false;
+        }
+        if (bytes_read < MAPPING_BLOCK_SIZE)
+        {
+            _at_end = true;
+            return !block.empty();
+        }
+
+        // keep the incomplete last line for the next block
+        size_t last_line_end = block.rfind('\n');
+        if (last_line_end != std::string::npos)
+        {
+            _rest.assign(block, last_line_end + 1, std::string::npos);
+            block.resize(last_line_end + 1);
+        }
+        return true;
+    }
+
+private:
+#if SEQAN_HAS_ZLIB
+    gzFile                  _file = nullptr;
+#else
+    std::ifstream           _file;
+#endif
+    std::string             _rest;
+    bool                    _at_end = false;
+    bool                    _failed = false;
+};
+
+// ----------------------------------------------------------------------------
+// Class accession_index_header
+// ----------------------------------------------------------------------------
+// An accession index (slimm_build index) is this header followed by the
+// front coded entries and the offsets of the blocks. Every block starts with
+// a full accession. An entry is: uint8 length of the prefix shared with the
+// previous accession, uint8 suffix length, the suffix and a uint32 taxid.
+// Accessions are sorted and unique. Numbers are in native byte order.
+struct accession_index_header
+{
+    char        magic[8];
+    uint32_t    byte_order;
+    uint32_t    block_size;
+    uint64_t    entries_count;
+    uint64_t    blocks_count;
+    uint64_t    block_offsets;
+    uint64_t    file_size;
+};
+
+// ----------------------------------------------------------------------------
+// Class accession_index_writer
+// ----------------------------------------------------------------------------
+class accession_index_writer
+{
+public:
+    bool open(std::string const & index_path)
+    {
+        _stream.open(index_path, std::ios::binary);
+        if (!_stream.is_open())
+            return false;
+        std::memset(&_header, 0, sizeof(_header));
+        _stream.write(reinterpret_cast<char const *>(&_header), sizeof(_header));
+        _offset = sizeof(_header);
+        return true;
+    }
+
+    // accessions have to be added in sorted order
+    void add(std::string const & accession, uint32_t const taxid)
+    {
+        size_t shared = 0;
+        if (_header.entries_count % INDEX_BLOCK_SIZE == 0)
+        {
+            _block_offsets.push_back(_offset);
+        }
+        else
+        {
+            size_t max_shared = std::min<size_t>(std::min(accession.size(), _previous.size()), 255);
+            while (shared < max_shared && accession[shared] == _previous[shared])
+                ++shared;
+        }
+        uint8_t lengths[2] = {uint8_t(shared), uint8_t(std::min<size_t>(accession.size() - shared, 255))};
+        _stream.write(reinterpret_cast<char const *>(lengths), sizeof(lengths));
+        _stream.write(accession.data() + shared, lengths[1]);
+        _stream.write(reinterpret_cast<char const *>(&taxid), sizeof(taxid));
+        _offset += sizeof(lengths) + lengths[1] + sizeof(taxid);
+        _previous = accession;
+        ++_header.entries_count;
+    }
+
+    void close()
+    {
+        while (_offset % 8 != 0)
+        {
+            _stream.put('\0');
+            ++_offset;
+        }
+        std::memcpy(_header.magic, ACCESSION_INDEX_MAGIC, sizeof(ACCESSION_INDEX_MAGIC));
+        _header.byte_order      = SLDB_BYTE_ORDER;
+        _header.block_size      = INDEX_BLOCK_SIZE;
+        _header.blocks_count    = _block_offsets.size();
+        _header.block_offsets   = _offset;
+        _header.file_size       = _offset + _block_offsets.size() * sizeof(uint64_t);
+        _stream.write(reinterpret_cast<char const *>(_block_offsets.data()), _block_offsets.size() * sizeof(uint64_t));
+        _stream.seekp(0);
+        _stream.write(reinterpret_cast<char const *>(&_header), sizeof(_header));
+        _stream.close();
+    }
+
+private:
+    std::ofstream               _stream;
+    accession_index_header      _header;
+    uint64_t                    _offset = 0;
+    std::vector<uint64_t>       _block_offsets;
+    std::string                 _previous;
+};
+
+// ----------------------------------------------------------------------------
+// Class accession_index
+// ----------------------------------------------------------------------------
+// A mapped accession index, looked up by a binary search over the first
+// accessions of the blocks and a scan of one block.
+class accession_index
+{
+public:
+    bool open(std::string const & index_path)
+    {
+        if (!_file.open(index_path) || _file.size() < sizeof(accession_index_header))
+            return false;
+        _header = reinterpret_cast<accession_index_header const *>(_file.data());
+        return std::memcmp(_header->magic, ACCESSION_INDEX_MAGIC, sizeof(ACCESSION_INDEX_MAGIC)) == 0 &&
+               _header->byte_order == SLDB_BYTE_ORDER &&
+               _header->file_size == _file.size();
+    }
+
+    inline uint64_t size() const
+    {
+        return _header->entries_count;
+    }
+
+    // the taxid of an accession or ACCESSION_NOT_FOUND
+    uint32_t find(char const * accession, size_t const accession_length) const
+    {
+        uint64_t const * block_offsets = reinterpret_cast<uint64_t const *>(_file.data() + _header->block_offsets);
+
+        // the last block that starts with an accession <= the wanted one
+        uint64_t first = 0, last = _header->blocks_count;
+        while (first < last)
+        {
+            uint64_t middle = first + (last - first) / 2;
+            char const * entry = _file.data() + block_offsets[middle];
+            if (_compare(entry + 2, uint8_t(entry[1]), accession, accession_length) <= 0)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        if (first == 0)
+            return ACCESSION_NOT_FOUND;
+
+        uint64_t block = first - 1;
+        uint64_t block_entries = std::min<uint64_t>(INDEX_BLOCK_SIZE, _header->entries_count - block * INDEX_BLOCK_SIZE);
+        char const * entry = _file.data() + block_offsets[block];
+        char current[512];
+        for (uint64_t i = 0; i < block_entries; ++i)
+        {
+            uint8_t shared = entry[0];
+            uint8_t suffix_length = entry[1];
+            std::memcpy(current + shared, entry + 2, suffix_length);
+            entry += 2 + suffix_length;
+            int cmp = _compare(current, shared + suffix_length, accession, accession_length);
+            if (cmp == 0)
+            {
+                uint32_t taxid;
+                std::memcpy(&taxid, entry, sizeof(taxid));
+                return taxid;
+            }
+            if (cmp > 0)
+                break;
+            entry += sizeof(uint32_t);
+        }
+        return ACCESSION_NOT_FOUND;
+    }
+
+private:
+    mapped_file                         _file;
+    accession_index_header const *      _header = nullptr;
+
+    inline static int _compare(char const * a, size_t const a_length, char const * b, size_t const b_length)
+    {
+        int cmp = std::memcmp(a, b, std::min(a_length, b_length));
+        if (cmp != 0)
+            return cmp;
+        return a_length < b_length ? -1 : (a_length > b_length ? 1 : 0);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class mapping_run
+// ----------------------------------------------------------------------------
+// A sorted run of mappings while an accession index is built. Runs are kept
+// in memory or written to a temporary file as
+// uint8 length, accession, uint32 taxid.
+class mapping_run
+{
+public:
+    inline size_t size() const
+    {
+        return _entries.size();
+    }
+
+    void add(char const * accession, size_t const accession_length, uint32_t const taxid)
+    {
+        _entries.push_back(entry{_pool.size(), taxid, uint8_t(std::min<size_t>(accession_length, 255))});
+        _pool.append(accession, _entries.back().length);
+    }
+
+    // sort by accession, the first mapping of an accession is kept
+    void sort()
+    {
+        std::stable_sort(_entries.begin(), _entries.end(), [this](entry const & a, entry const & b)
+        {
+            return _compare(a, b) < 0;
+        });
+        _entries.erase(std::unique(_entries.begin(), _entries.end(), [this](entry const & a, entry const & b)
+        {
+            return _compare(a, b) == 0;
+        }), _entries.end());
+    }
+
+    template <typename TFunctor>
+    void for_each(TFunctor && f) const
+    {
+        for (auto const & e : _entries)
+            f(_accession(e), e.taxid);
+    }
+
+    bool write(std::string const & run_path) const
+    {
+        std::ofstream os(run_path, std::ios::binary);
+        if (!os.is_open())
+            return false;
+        for (auto const & e : _entries)
+        {
+            os.put(char(e.length));
+            os.write(_pool.data() + e.offset, e.length);
+            os.write(reinterpret_cast<char const *>(&e.taxid), sizeof(e.taxid));
+        }
+        return bool(os);
+    }
+
+    void clear()
+    {
+        _entries.clear();
+        _pool.clear();
+    }
+
+private:
+    struct entry
+    {
+        uint64_t    offset;
+        uint32_t    taxid;
+        uint8_t     length;
+    };
+
+    std::vector<entry>      _entries;
+    std::string             _pool;
+
+    inline std::string _accession(entry const & e) const
+    {
+        return std::string(_pool.data() + e.offset, e.length);
+    }
+
+    inline int _compare(entry const & a, entry const & b) const
+    {
+        int cmp = std::memcmp(_pool.data() + a.offset, _pool.data() + b.offset, std::min(a.length, b.length));
+        if (cmp != 0)
+            return cmp;
+        return int(a.length) - int(b.length);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class mapping_run_reader
+// ----------------------------------------------------------------------------
+class mapping_run_reader
+{
+public:
+    std::string     accession;
+    uint32_t        taxid = 0;
+
+    bool open(std::string const & run_path)
+    {
+        _stream.open(run_path, std::ios::binary);
+        return _stream.is_open();
+    }
+
+    // reads the next mapping into accession and taxid
+    bool next()
+    {
+        int length = _stream.get();
+        if (length == std::char_traits<char>::eof())
+            return false;
+        accession.resize(length);
+        if (length > 0)
+            _stream.read(&accession[0], length);
+        _stream.read(reinterpret_cast<char *>(&taxid), sizeof(taxid));
+        return bool(_stream);
+    }
+
+private:
+    std::ifstream   _stream;
+};
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function is_accession_index()
+// --------------------------------------------------------------------------
+inline bool is_accession_index(std::string const & file_path)
+{
+    char magic[sizeof(ACCESSION_INDEX_MAGIC)] = {0};
+    std::ifstream is(file_path, std::ios::binary);
+    return is.read(magic, sizeof(magic)) && std::memcmp(magic, ACCESSION_INDEX_MAGIC, sizeof(magic)) == 0;
+}
+
+// --------------------------------------------------------------------------
+// Function parse_mapping_taxid()
+// --------------------------------------------------------------------------
+// parses the taxid of a mapping line given the end of its first column
+inline bool parse_mapping_taxid(uint32_t & taxid, char const * first_tab, char const * line_end)
+{
+    // skip the accession.version column
+    char const * pos = static_cast<char const *>(std::memchr(first_tab + 1, '\t', line_end - first_tab - 1));
+    if (pos == nullptr)
+        return false;
+    ++pos;
+    taxid = 0;
+    char const * digits_begin = pos;
+    for (; pos < line_end && *pos >= '0' && *pos <= '9'; ++pos)
+        taxid = taxid * 10 + (*pos - '0');
+    return pos != digits_begin;
+}
+
+// --------------------------------------------------------------------------
+// Function parse_mapping_block()
+// --------------------------------------------------------------------------
+// Finds the wanted accessions in a block of accession2taxid lines
+// (accession <tab> accession.version <tab> taxid <tab> gi) and appends their
+// (index, taxid) in the order they appear.
+inline void parse_mapping_block(std::vector<std::pair<uint32_t, uint32_t> > & hits,
+                                std::string const & block,
+                                accession_probe const & probe)
+{
+    char const * pos = block.data();
+    char const * end = pos + block.size();
+    while (pos < end)
+    {
+        char const * line_end = static_cast<char const *>(std::memchr(pos, '\n', end - pos));
+        if (line_end == nullptr)
+            line_end = end;
+
+        char const * tab = static_cast<char const *>(std::memchr(pos, '\t', line_end - pos));
+        if (tab != nullptr)
+        {
+            uint32_t index = probe.find(pos, tab - pos);
+            uint32_t taxid = 0;
+            if (index != ACCESSION_NOT_FOUND && parse_mapping_taxid(taxid, tab, line_end))
+                hits.push_back(std::make_pair(index, taxid));
+        }
+        pos = line_end + 1;
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function map_accessions_to_taxids()
+// --------------------------------------------------------------------------
+// Streams the mapping files once and looks up every line in the set of
+// wanted accessions. Blocks of lines are parsed by several threads, the
+// first mapping of an accession (by file, then by position) is used.
+// Returns the taxid of every accession, ACCESSION_NOT_FOUND if there is none.
+inline std::vector<uint32_t> map_accessions_to_taxids(std::vector<std::string> const & accessions,
+                                                      std::vector<std::string> const & mapping_paths,
+                                                      uint32_t const threads,
+                                                      bool const verbose)
+{
+    std::vector<uint32_t> taxids(accessions.size(), ACCESSION_NOT_FOUND);
+    size_t missing_count = accessions.size();
+    accession_probe probe(accessions);
+
+    uint32_t threads_count = get_usable_threads(threads);
+    std::vector<std::string> blocks(threads_count);
+    std::vector<std::vector<std::pair<uint32_t, uint32_t> > > block_hits(threads_count);
+
+    for (uint32_t file_number = 0; file_number < mapping_paths.size() && missing_count > 0; ++file_number)
+    {
+        // accession indexes are searched for the missing accessions
+        if (is_accession_index(mapping_paths[file_number]))
+        {
+            accession_index index;
+            if (!index.open(mapping_paths[file_number]))
+            {
+                std::cerr << "[ERROR] " << mapping_paths[file_number] << " is not a valid accession index!\n";
+                exit(1);
+            }
+            int64_t accessions_count = accessions.size();
+            #pragma omp parallel for num_threads(threads_count) schedule(static, 4096) reduction(-:missing_count)
+            for (int64_t i = 0; i < accessions_count; ++i)
+            {
+                if (taxids[i] != ACCESSION_NOT_FOUND)
+                    continue;
+                taxids[i] = index.find(accessions[i].data(), accessions[i].size());
+                if (taxids[i] != ACCESSION_NOT_FOUND)
+                    --missing_count;
+            }
+            if (verbose)
+            {
+                std::cerr << "[VERBOSE MSG] accession index: ["<< file_number + 1 <<"/"<< mapping_paths.size() << "]\t";
+                std::cerr << "accessions left: ["<< missing_count << "/" << accessions.size() <<"]\n";
+            }
+            continue;
+        }
+
+        line_block_reader reader;
+        if (!reader.open(mapping_paths[file_number]))
+        {
+            std::cerr << "[ERROR] Unable to open mapping file: " << mapping_paths[file_number] << "\n";
+            exit(1);
+        }
+
+        bool at_end = false;
+        while (!at_end && missing_count > 0)
+        {
+            // read a block per thread, then parse them at the same time
+            int32_t blocks_count = 0;
+            for (; blocks_count < int32_t(threads_count); ++blocks_count)
+            {
+                if (!reader.read(blocks[blocks_count]))
+                {
+                    at_end = true;
+                    break;
+                }
+            }
+
+            #pragma omp parallel for num_threads(threads_count) schedule(static, 1)
+            for (int32_t i = 0; i < blocks_count; ++i)
+            {
+                block_hits[i].clear();
+                parse_mapping_block(block_hits[i], blocks[i], probe);
+            }
+
+            for (int32_t i = 0; i < blocks_count; ++i)
+            {
+                for (auto const & hit : block_hits[i])
+                {
+                    if (taxids[hit.first] != ACCESSION_NOT_FOUND)
+                        continue;
+                    taxids[hit.first] = hit.second;
+                    --missing_count;
+                }
+            }
+        }
+        if (reader.failed())
+        {
+            std::cerr << "[ERROR] Unable to read mapping file (truncated or corrupt?): " << mapping_paths[file_number] << "\n";
+            exit(1);
+        }
+
+        if (verbose)
+        {
+            std::cerr << "[VERBOSE MSG] mapping file: ["<< file_number + 1 <<"/"<< mapping_paths.size() << "]\t";
+            std::cerr << "accessions left: ["<< missing_count << "/" << accessions.size() <<"]\n";
+        }
+    }
+    return taxids;
+}
+
+// --------------------------------------------------------------------------
+// Function build_accession_index()
+// --------------------------------------------------------------------------
+// Converts accession2taxid files into an accession index. The mappings are
+// sorted in runs of INDEX_RUN_SIZE, runs that do not fit are written next to
+// the index and merged. As with the text files the first mapping of an
+// accession (by file, then by position) is kept. The runs are removed on
+// every way out, also when the index can not be built.
+inline bool build_accession_index(std::vector<std::string> const & mapping_paths,
+                                  std::string const & index_path,
+                                  bool const verbose)
+{
+    struct run_files
+    {
+        std::vector<std::string> paths;
+        ~run_files()
+        {
+            for (auto const & run_path : paths)
+                std::remove(run_path.c_str());
+        }
+    };
+
+    mapping_run run;
+    run_files runs;
+    std::vector<std::string> & run_paths = runs.paths;
+    std::string block;
+    uint64_t lines_count = 0;
+
+    auto flush_run = [&]() -> bool
+    {
+        run.sort();
+        std::string run_path = index_path + ".run" + std::to_string(run_paths.size());
+        run_paths.push_back(run_path);
+        if (!run.write(run_path))
+        {
+            std::cerr << "[ERROR] Unable to write " << run_path << "!\n";
+            return false;
+        }
+        run.clear();
+        return true;
+    };
+
+    for (auto const & mapping_path : mapping_paths)
+    {
+        line_block_reader reader;
+        if (!reader.open(mapping_path))
+        {
+            std::cerr << "[ERROR] Unable to open mapping file: " << mapping_path << "\n";
+            return false;
+        }
+        while (reader.read(block))
+        {
+            char const * pos = block.data();
+            char const * end = pos + block.size();
+            while (pos < end)
+            {
+                char const * line_end = static_cast<char const *>(std::memchr(pos, '\n', end - pos));
+                if (line_end == nullptr)
+                    line_end = end;
+                char const * tab = static_cast<char const *>(std::memchr(pos, '\t', line_end - pos));
+                uint32_t taxid = 0;
+                if (tab != nullptr && parse_mapping_taxid(taxid, tab, line_end))
+                {
+                    run.add(pos, tab - pos, taxid);
+                    ++lines_count;
+                    if (run.size() == INDEX_RUN_SIZE && !flush_run())
+                        return false;
+                }
+                pos = line_end + 1;
+            }
+        }
+        if (reader.failed())
+        {
+            std::cerr << "[ERROR] Unable to read mapping file (truncated or corrupt?): " << mapping_path << "\n";
+            return false;
+        }
+        if (verbose)
+            std::cerr << "[VERBOSE MSG] " << lines_count << " mappings read after " << mapping_path << "\n";
+    }
+
+    accession_index_writer writer;
+    if (!writer.open(index_path))
+    {
+        std::cerr << "[ERROR] Unable to write " << index_path << "!\n";
+        return false;
+    }
+
+    if (run_paths.empty())
+    {
+        run.sort();
+        run.for_each([&writer](std::string const & accession, uint32_t taxid) { writer.add(accession, taxid); });
+        writer.close();
+        return true;
+    }
+    if (run.size() > 0 && !flush_run())
+        return false;
+
+    // merge the runs, on equal accessions the earlier run wins
+    std::vector<mapping_run_reader> readers(run_paths.size());
+    typedef std::pair<std::string, uint32_t> queue_entry;  // accession, run number
+    std::priority_queue<queue_entry, std::vector<queue_entry>, std::greater<queue_entry> > queue;
+    for (uint32_t i = 0; i < run_paths.size(); ++i)
+    {
+        if (!readers[i].open(run_paths[i]))
+        {
+            std::cerr << "[ERROR] Unable to read " << run_paths[i] << "!\n";
+            return false;
+        }
+        if (readers[i].next())
+            queue.push(queue_entry(readers[i].accession, i));
+    }
+
+    std::string last_accession;
+    bool first_entry = true;
+    while (!queue.empty())
+    {
+        uint32_t i = queue.top().second;
+        queue.pop();
+        if (first_entry || readers[i].accession != last_accession)
+        {
+            writer.add(readers[i].accession, readers[i].taxid);
+            last_accession = readers[i].accession;
+            first_entry = false;
+        }
+        if (readers[i].next())
+            queue.push(queue_entry(readers[i].accession, i));
+    }
+    writer.close();
+    return true;
+}
+
+#endif /* ACCESSION_MAP_H */
@@ -0,0 +1,393 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef BGZF_READER_H
+#define BGZF_READER_H
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <stdexcept>
+#include <condition_variable>
+
+#if SEQAN_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace seqan;
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class parallel_bgzf_streambuf
+// ----------------------------------------------------------------------------
+// Reads the compressed BGZF blocks of a BAM file on the calling thread and
+// inflates them on a pool of worker threads. Decompressed blocks are handed
+// out strictly in file order, so the record parser sees the same byte stream
+// it would get from a single threaded reader. Broken input throws an
+// std::runtime_error, so one bad file does not end a process profiling others.
+class parallel_bgzf_streambuf : public std::streambuf
+{
+public:
+    explicit parallel_bgzf_streambuf(uint32_t threads):
+                        _threads(std::max(threads, 1u)),
+                        _window_size(4 * std::max(threads, 1u)) {}
+
+    ~parallel_bgzf_streambuf()
+    {
+        close();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _job_ready.notify_all();
+        for (auto & worker : _workers)
+            worker.join();
+    }
+
+    bool open(std::string const & file_path)
+    {
+        close();
+        _file.open(file_path, std::ios::binary);
+        if (!_file.is_open())
+            return false;
+        _file_path = file_path;
+        _eof = false;
+        _compressed_bytes_read = 0;
+        while (_workers.size() < _threads)
+            _workers.emplace_back(&parallel_bgzf_streambuf::_work, this);
+        return true;
+    }
+
+    void close()
+    {
+        {
+            // blocks still being inflated are kept alive by the worker
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.clear();
+            _window.clear();
+        }
+        _current.reset();
+        setg(nullptr, nullptr, nullptr);
+        if (_file.is_open())
+            _file.close();
+    }
+
+    inline uint64_t compressed_bytes_read() const
+    {
+        return _compressed_bytes_read;
+    }
+
+protected:
+    int_type underflow()
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        while (true)
+        {
+            _fill_window();
+
+            std::shared_ptr<bgzf_block> block;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                if (_window.empty())
+                    return traits_type::eof();
+                block = _window.front();
+                _window.pop_front();
+                _block_ready.wait(lock, [&block]{ return block->ready; });
+            }
+
+            if (block->failed)
+                throw std::runtime_error("corrupt BGZF block in " + _file_path);
+
+            // the previous block is not referenced by any worker anymore
+            if (_current)
+                _free_blocks.push_back(_current);
+            _current = block;
+
+            // skip empty blocks (e.g. the EOF marker)
+            if (!_current->data.empty())
+            {
+                char * data = &_current->data[0];
+                setg(data, data, data + _current->data.size());
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+    }
+
+private:
+    struct bgzf_block
+    {
+        std::vector<char>   compressed;
+        std::vector<char>   data;
+        bool                ready  = false;
+        bool                failed = false;
+    };
+
+    uint32_t                                    _threads;
+    size_t                                      _window_size;
+    bool                                        _eof = true;
+    bool                                        _stop = false;
+    uint64_t                                    _compressed_bytes_read = 0;
+    std::string                                 _file_path;
+    std::ifstream                               _file;
+
+    std::shared_ptr<bgzf_block>                 _current;
+    std::vector<std::shared_ptr<bgzf_block> >   _free_blocks;
+    // blocks in file order waiting to be handed out
+    std::deque<std::shared_ptr<bgzf_block> >    _window;
+    // blocks waiting for a worker thread
+    std::deque<std::shared_ptr<bgzf_block> >    _jobs;
+    std::vector<std::thread>                    _workers;
+    std::mutex                                  _mutex;
+    std::condition_variable                     _job_ready;
+    std::condition_variable                     _block_ready;
+
+    // keep up to _window_size blocks in flight
+    inline void _fill_window()
+    {
+        while (!_eof)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_window.size() >= _window_size)
+                    return;
+            }
+
+            std::shared_ptr<bgzf_block> block;
+            if (_free_blocks.empty())
+            {
+                block = std::make_shared<bgzf_block>();
+            }
+            else
+            {
+                block = _free_blocks.back();
+                _free_blocks.pop_back();
+                block->ready  = false;
+                block->failed = false;
+            }
+
+            if (!_read_block(*block))
+            {
+                _eof = true;
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _window.push_back(block);
+                _jobs.push_back(block);
+            }
+            _job_ready.notify_one();
+        }
+    }
+
+    // reads one compressed block (header, payload and footer) from the file
+    inline bool _read_block(bgzf_block & block)
+    {
+        unsigned char header[12];
+        if (!_file.read(reinterpret_cast<char *>(header), 12))
+            return false;
+
+        if (header[0] != 31 || header[1] != 139 || header[2] != 8 || (header[3] & 4) == 0)
+            throw std::runtime_error(_file_path + " is not a valid BGZF file");
+
+        uint16_t extra_length = header[10] | (header[11] << 8);
+        if (extra_length == 0)
+            throw std::runtime_error("missing BGZF block size in " + _file_path);
+        std::vector<unsigned char> extra(extra_length);
+        if (!_file.read(reinterpret_cast<char *>(&extra[0]), extra_length))
+            return false;
+
+        // look for the BC subfield which holds the total block size - 1
+        uint32_t block_size = 0;
+        for (uint32_t i = 0; i + 4 <= extra_length;)
+        {
+            uint16_t sub_length = extra[i + 2] | (extra[i + 3] << 8);
+            if (extra[i] == 66 && extra[i + 1] == 67 && sub_length == 2 && i + 6 <= extra_length)
+                block_size = (extra[i + 4] | (extra[i + 5] << 8)) + 1;
+            i += 4 + sub_length;
+        }
+
+        if (block_size < 12u + extra_length + 8u)
+            throw std::runtime_error("missing BGZF block size in " + _file_path);
+
+        block.compressed.resize(block_size - 12 - extra_length);
+        if (!_file.read(&block.compressed[0], block.compressed.size()))
+            return false;
+
+        _compressed_bytes_read += block_size;
+        return true;
+    }
+
+    // decompresses a block into block.data and verifies size and CRC
+    static inline bool _inflate_block(bgzf_block & block)
+    {
+#if SEQAN_HAS_ZLIB
+        size_t payload_size = block.compressed.size() - 8;
+        unsigned char const * footer = reinterpret_cast<unsigned char const *>(&block.compressed[payload_size]);
+        uint32_t crc = footer[0] | (footer[1] << 8) | (footer[2] << 16) | (uint32_t(footer[3]) << 24);
+        uint32_t data_size = footer[4] | (footer[5] << 8) | (footer[6] << 16) | (uint32_t(footer[7]) << 24);
+
+        block.data.resize(data_size);
+        if (data_size == 0)
+            return true;
+
+        z_stream zs;
+        zs.zalloc = Z_NULL;
+        zs.zfree = Z_NULL;
+        zs.opaque = Z_NULL;
+        zs.next_in = reinterpret_cast<Bytef *>(&block.compressed[0]);
+        zs.avail_in = payload_size;
+        zs.next_out = reinterpret_cast<Bytef *>(&block.data[0]);
+        zs.avail_out = data_size;
+
+        // raw deflate stream, the gzip header and footer are handled here
+        if (inflateInit2(&zs, -15) != Z_OK)
+            return false;
+        int status = inflate(&zs, Z_FINISH);
+        inflateEnd(&zs);
+
+        if (status != Z_STREAM_END || zs.total_out != data_size)
+            return false;
+        return crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<Bytef *>(&block.data[0]), data_size) == crc;
+#else
+        (void)block;
+        return false;
+#endif
+    }
+
+    inline void _work()
+    {
+        while (true)
+        {
+            std::shared_ptr<bgzf_block> block;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _job_ready.wait(lock, [this]{ return _stop || !_jobs.empty(); });
+                if (_jobs.empty())
+                    return;
+                block = _jobs.front();
+                _jobs.pop_front();
+            }
+
+            bool ok = _inflate_block(*block);
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                block->failed = !ok;
+                block->ready = true;
+            }
+            _block_ready.notify_all();
+        }
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class parallel_bgzf_istream
+// ----------------------------------------------------------------------------
+class parallel_bgzf_istream : public std::istream
+{
+public:
+    explicit parallel_bgzf_istream(uint32_t threads): std::istream(nullptr), _buffer(threads)
+    {
+        rdbuf(&_buffer);
+        // pass the errors of the buffer on instead of only setting the badbit
+        exceptions(std::ios::badbit);
+    }
+
+    bool open(std::string const & file_path)
+    {
+        clear();
+        return _buffer.open(file_path);
+    }
+
+    void close()
+    {
+        _buffer.close();
+    }
+
+    inline uint64_t compressed_bytes_read() const
+    {
+        return _buffer.compressed_bytes_read();
+    }
+
+private:
+    parallel_bgzf_streambuf     _buffer;
+};
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function is_bgzf_file()
+// --------------------------------------------------------------------------
+// checks for the gzip magic number followed by the BGZF "BC" extra subfield
+inline bool is_bgzf_file(std::string const & file_path)
+{
+#if SEQAN_HAS_ZLIB
+    unsigned char header[14];
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file.read(reinterpret_cast<char *>(header), 14))
+        return false;
+    return header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4) != 0 &&
+           header[12] == 66 && header[13] == 67;
+#else
+    (void)file_path;
+    return false;
+#endif
+}
+
+// --------------------------------------------------------------------------
+// Function read_bam_file()
+// --------------------------------------------------------------------------
+// try to open a BAM file through a parallel_bgzf_istream
+inline bool read_bam_file(BamFileIn & bam_file,
+                          BamHeader & bam_header,
+                          parallel_bgzf_istream & bgzf_stream,
+                          std::string const & bam_file_path)
+{
+    if (!bgzf_stream.open(bam_file_path) || !open(bam_file, bgzf_stream, Bam()))
+    {
+        std::cerr << "Could not open " << bam_file_path << "!\n";
+        return false;
+    }
+    readHeader(bam_header, bam_file);
+    return true;
+}
+
+#endif /* BGZF_READER_H */
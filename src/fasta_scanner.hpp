@@ -0,0 +1,141 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef FASTA_SCANNER_H
+#define FASTA_SCANNER_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+
+using namespace seqan;
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function is_compressed_file()
+// --------------------------------------------------------------------------
+// checks for the gzip (also BGZF) and bzip2 magic bytes
+inline bool is_compressed_file(std::string const & file_path)
+{
+    unsigned char magic[3] = {0, 0, 0};
+    std::ifstream is(file_path, std::ios::binary);
+    if (!is.read(reinterpret_cast<char *>(magic), sizeof(magic)))
+        return false;
+    return (magic[0] == 0x1f && magic[1] == 0x8b) || (magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h');
+}
+
+// --------------------------------------------------------------------------
+// Function get_fai_accessions()
+// --------------------------------------------------------------------------
+// the accessions of the sequence names (first column) of a FASTA index,
+// nothing is added to accessions if the index is not valid
+inline bool get_fai_accessions(std::vector<std::string> & accessions, std::string const & fai_path)
+{
+    std::ifstream fai_stream(fai_path);
+    if (!fai_stream.is_open())
+        return false;
+
+    std::vector<std::string> found;
+    std::string line;
+    while (std::getline(fai_stream, line))
+    {
+        size_t name_length = line.find('\t');
+        if (name_length == std::string::npos || name_length == 0)
+            return false;
+        found.push_back(line.substr(0, accession_length(line.data(), name_length)));
+    }
+
+    if (accessions.empty())
+        accessions.swap(found);
+    else
+        accessions.insert(accessions.end(), found.begin(), found.end());
+    return true;
+}
+
+// --------------------------------------------------------------------------
+// Function scan_fasta_accessions()
+// --------------------------------------------------------------------------
+// The accessions of an uncompressed FASTA file. Only the header lines are
+// looked at: the file is mapped, split into one chunk per thread and every
+// chunk is searched for '>' at the start of a line. A header belongs to the
+// chunk its '>' is in.
+inline bool scan_fasta_accessions(std::vector<std::string> & accessions,
+                                  std::string const & fasta_path,
+                                  uint32_t const threads)
+{
+    mapped_file fasta_file;
+    if (!fasta_file.open(fasta_path))
+        return false;
+
+    char const * data = fasta_file.data();
+    uint64_t size = fasta_file.size();
+    if (data[0] != '>')
+        return false;
+
+    uint32_t threads_count = get_usable_threads(threads);
+    std::vector<std::vector<std::string> > chunk_accessions(threads_count);
+
+    #pragma omp parallel for num_threads(threads_count) schedule(static, 1)
+    for (int32_t chunk = 0; chunk < int32_t(threads_count); ++chunk)
+    {
+        uint64_t chunk_begin = size * chunk / threads_count;
+        uint64_t chunk_end = size * (chunk + 1) / threads_count;
+        std::vector<std::string> & found = chunk_accessions[chunk];
+
+        char const * pos = data + chunk_begin;
+        char const * end = data + chunk_end;
+        while (pos < end)
+        {
+            pos = static_cast<char const *>(std::memchr(pos, '>', end - pos));
+            if (pos == nullptr)
+                break;
+            if (pos == data || pos[-1] == '\n')
+            {
+                char const * name = pos + 1;
+                char const * line_end = static_cast<char const *>(std::memchr(name, '\n', data + size - name));
+                size_t name_length = (line_end == nullptr ? data + size : line_end) - name;
+                found.push_back(std::string(name, accession_length(name, name_length)));
+            }
+            ++pos;
+        }
+    }
+
+    for (auto & found : chunk_accessions)
+        accessions.insert(accessions.end(), found.begin(), found.end());
+    return true;
+}
+
+#endif /* FASTA_SCANNER_H */
@@ -6,6 +6,11 @@ using namespace seqan;
 #include <fstream>
 #include <map>
 #include <utility>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <sys/stat.h>
 
 #ifdef _WIN32
     #include <io.h>
@@ -85,6 +90,23 @@ bool is_file(const char* path)
     return access(path, 0 ) == 0;
 }
 
+uint64_t get_file_size(std::string const & file_path)
+{
+    struct stat st;
+    if (stat(file_path.c_str(), &st) == -1)
+        return 0;
+    return st.st_size;
+}
+
+// size and modification time of a file, used to tell if a file has changed
+uint64_t get_file_stamp(std::string const & file_path)
+{
+    struct stat st;
+    if (stat(file_path.c_str(), &st) == -1)
+        return 0;
+    return (uint64_t(st.st_mtime) << 32) ^ uint64_t(st.st_size);
+}
+
 std::string get_file_name (const std::string& str)
 {
     std::size_t found = str.find_last_of("/\\");
@@ -97,23 +119,40 @@ std::string get_directory (const std::string& str)
     return str.substr(0,found);
 }
 
+// extension of the state files written by slimm --save-state
+std::string const STATE_FILE_EXTENSION = ".slst";
+
+bool is_state_file(const std::string& input_path)
+{
+    return input_path.size() > STATE_FILE_EXTENSION.size() &&
+           input_path.compare(input_path.size() - STATE_FILE_EXTENSION.size(),
+                              STATE_FILE_EXTENSION.size(), STATE_FILE_EXTENSION) == 0;
+}
+
+// the file name of a SAM/BAM (or state) file without its extension
+std::string get_sample_name(const std::string& input_path)
+{
+    std::string file_name = get_file_name(input_path);
+    if (is_state_file(file_name))
+        file_name.resize(file_name.size() - STATE_FILE_EXTENSION.size());
+
+    if ((file_name.find(".sam") != std::string::npos &&
+       file_name.find(".sam") == file_name.find_last_of("."))
+        ||
+        (file_name.find(".bam") != std::string::npos &&
+           file_name.find(".bam")  == file_name.find_last_of(".")))
+    {
+        file_name.replace((file_name.find_last_of(".")), 4, "");
+    }
+    return file_name;
+}
+
 std::string get_tsv_file_name(const std::string & output_prefix, const std::string& input_path)
 {
     std::string dir_name = get_directory(output_prefix);
     std::string file_name = get_file_name(output_prefix);
     if (file_name.size() == 0)
-    {
-        file_name = get_file_name(input_path);
-
-        if ((file_name.find(".sam") != std::string::npos &&
-           file_name.find(".sam") == file_name.find_last_of("."))
-            ||
-            (file_name.find(".bam") != std::string::npos &&
-               file_name.find(".bam")  == file_name.find_last_of(".")))
-        {
-            file_name.replace((file_name.find_last_of(".")), 4, "");
-        }
-    }
+        file_name = get_sample_name(input_path);
     return dir_name + "/" + file_name;
 }
 
@@ -121,3 +160,110 @@ std::string get_tsv_file_name (const std::string& output_prefix, const std::stri
 {
     return get_tsv_file_name(output_prefix, input_path) + decor_suffix + ".tsv";
 }
+
+// ----------------------------------------------------------------------------
+// Class buffered_writer
+// ----------------------------------------------------------------------------
+// Writes text to a file in large blocks. Numbers are formatted by hand
+// (integers) or with snprintf (floating points, "%g" like std::ostream)
+// which gives the same text as operator<< of an std::ofstream, only faster.
+class buffered_writer
+{
+public:
+    explicit buffered_writer(std::string const & file_path, size_t buffer_size = 1 << 20):
+                                _stream(file_path, std::ios::binary),
+                                _buffer(buffer_size) {}
+
+    ~buffered_writer()
+    {
+        close();
+    }
+
+    inline bool is_open() const
+    {
+        return _stream.is_open();
+    }
+
+    inline buffered_writer & operator<<(char const c)
+    {
+        if (_size == _buffer.size())
+            flush();
+        _buffer[_size++] = c;
+        return *this;
+    }
+
+    inline buffered_writer & operator<<(char const * str)
+    {
+        return write(str, std::strlen(str));
+    }
+
+    inline buffered_writer & operator<<(std::string const & str)
+    {
+        return write(str.data(), str.size());
+    }
+
+    template <typename TNumber>
+    inline typename std::enable_if<std::is_integral<TNumber>::value, buffered_writer &>::type
+    operator<<(TNumber const number)
+    {
+        char digits[24];
+        char * end = digits + sizeof(digits);
+        char * pos = end;
+        typename std::make_unsigned<TNumber>::type value = number;
+        if (number < 0)
+            value = 0 - value;
+        do
+        {
+            *--pos = '0' + value % 10;
+            value /= 10;
+        } while (value != 0);
+        if (number < 0)
+            *--pos = '-';
+        return write(pos, end - pos);
+    }
+
+    template <typename TNumber>
+    inline typename std::enable_if<std::is_floating_point<TNumber>::value, buffered_writer &>::type
+    operator<<(TNumber const number)
+    {
+        char digits[32];
+        int length = std::snprintf(digits, sizeof(digits), "%g", static_cast<double>(number));
+        return write(digits, length);
+    }
+
+    inline buffered_writer & write(char const * data, size_t length)
+    {
+        if (_size + length > _buffer.size())
+        {
+            flush();
+            if (length > _buffer.size())
+            {
+                _stream.write(data, length);
+                return *this;
+            }
+        }
+        std::memcpy(&_buffer[_size], data, length);
+        _size += length;
+        return *this;
+    }
+
+    inline void flush()
+    {
+        _stream.write(_buffer.data(), _size);
+        _size = 0;
+    }
+
+    void close()
+    {
+        if (_stream.is_open())
+        {
+            flush();
+            _stream.close();
+        }
+    }
+
+private:
+    std::ofstream           _stream;
+    std::vector<char>       _buffer;
+    size_t                  _size = 0;
+};
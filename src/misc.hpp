@@ -9,6 +9,25 @@ uint32_t const LINAGE_LENGTH = 8;
 #include <fstream>
 #include <map>
 #include <utility>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <limits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    #include <immintrin.h>
+#endif
+
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
 
 #include <cereal/types/common.hpp>
 #include <cereal/types/tuple.hpp>
@@ -74,6 +93,117 @@ std::string from_taxa_ranks_short(const taxa_ranks &rnk)
     else                              return "i";
 }
 
+// ----------------------------------------------------------------------------
+// Class mapped_file
+// ----------------------------------------------------------------------------
+// A read only view of a whole file. The file is mmap'ed, so concurrent
+// processes share the pages, or read into memory where mmap is not available.
+class mapped_file
+{
+public:
+    mapped_file() {}
+    mapped_file(mapped_file const &) = delete;
+    mapped_file & operator=(mapped_file const &) = delete;
+
+    ~mapped_file()
+    {
+        close();
+    }
+
+    bool open(std::string const & file_path)
+    {
+        close();
+#ifdef _WIN32
+        std::ifstream is(file_path, std::ios::binary);
+        if (!is.is_open())
+            return false;
+        is.seekg(0, std::ios::end);
+        _buffer.resize(is.tellg());
+        is.seekg(0, std::ios::beg);
+        if (!_buffer.empty() && !is.read(&_buffer[0], _buffer.size()))
+            return false;
+        _data = _buffer.data();
+        _size = _buffer.size();
+#else
+        int fd = ::open(file_path.c_str(), O_RDONLY);
+        if (fd == -1)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) == -1 || st.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void * data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return false;
+        _data = static_cast<char const *>(data);
+        _size = st.st_size;
+#endif
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        std::vector<char>().swap(_buffer);
+#else
+        if (_data != nullptr)
+            munmap(const_cast<char *>(_data), _size);
+#endif
+        _data = nullptr;
+        _size = 0;
+    }
+
+    inline char const * data() const    { return _data; }
+    inline uint64_t size() const        { return _size; }
+
+private:
+    char const *            _data = nullptr;
+    uint64_t                _size = 0;
+#ifdef _WIN32
+    std::vector<char>       _buffer;
+#endif
+};
+
+// ----------------------------------------------------------------------------
+// Class sldb_v2_header
+// ----------------------------------------------------------------------------
+// Layout of a version 2 .sldb file. All sections are 8-byte aligned arrays in
+// native byte order that are used in place:
+//   accession_offsets  (accessions_count + 1) x uint64  offsets into accession_pool
+//   accession_pool     the accessions in sorted order (not 0 terminated)
+//   lineages           accessions_count x LINAGE_LENGTH x uint32
+//   taxa_ids           taxa_count x uint32 in increasing order
+//   taxa_ranks         taxa_count x uint8
+//   name_offsets       (taxa_count + 1) x uint64  offsets into name_pool
+//   name_pool          the names of taxa_ids (not 0 terminated)
+char const      SLDB_V2_MAGIC[8]    = {'S', 'L', 'D', 'B', '\0', 'v', '2', '\0'};
+uint32_t const  SLDB_BYTE_ORDER     = 0x01020304;
+
+struct sldb_v2_header
+{
+    char        magic[8];
+    uint32_t    byte_order;
+    uint32_t    lineage_length;
+    uint64_t    accessions_count;
+    uint64_t    accession_offsets;
+    uint64_t    accession_pool;
+    uint64_t    lineages;
+    uint64_t    taxa_count;
+    uint64_t    taxa_ids;
+    uint64_t    taxa_ranks;
+    uint64_t    name_offsets;
+    uint64_t    name_pool;
+    uint64_t    file_size;
+};
+
+// ----------------------------------------------------------------------------
+// Class slimm_database
+// ----------------------------------------------------------------------------
+// Version 1 databases are deserialized into the two maps, version 2 databases
+// are mapped and searched in place (the maps stay empty).
 struct slimm_database
 {
 public:
@@ -83,6 +213,151 @@ public:
     // maps taxon ids to a tuple of their rank and name
     std::unordered_map<uint32_t, std::tuple<taxa_ranks, std::string> >  taxid__name;
 
+    inline bool is_mapped() const
+    {
+        return _header != nullptr;
+    }
+
+    inline uint64_t accessions_count() const
+    {
+        return is_mapped() ? _header->accessions_count : ac__taxid.size();
+    }
+
+    // returns the linage of an accession or nullptr if it is not in the database
+    inline uint32_t const * find_lineage(std::string const & accession) const
+    {
+        if (!is_mapped())
+        {
+            auto ac_pos = ac__taxid.find(accession);
+            if (ac_pos == ac__taxid.end())
+                return nullptr;
+            return &ac_pos->second[0];
+        }
+
+        uint64_t const * offsets = _section<uint64_t>(_header->accession_offsets);
+        char const * pool = _section<char>(_header->accession_pool);
+        uint64_t first = 0, last = _header->accessions_count;
+        while (first < last)
+        {
+            uint64_t middle = first + (last - first) / 2;
+            int cmp = _compare(pool + offsets[middle], offsets[middle + 1] - offsets[middle], accession);
+            if (cmp == 0)
+                return _section<uint32_t>(_header->lineages) + middle * LINAGE_LENGTH;
+            if (cmp < 0)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        return nullptr;
+    }
+
+    // returns the linage of an accession or a linage of unknowns (0s) if it is not in the database
+    inline uint32_t const * lineage_of(std::string const & accession) const
+    {
+        static uint32_t const unknown_lineage[LINAGE_LENGTH] = {0};
+        uint32_t const * lineage = find_lineage(accession);
+        return lineage == nullptr ? unknown_lineage : lineage;
+    }
+
+    // calls f(lineage) for every accession in the database
+    template <typename TFunctor>
+    inline void for_each_lineage(TFunctor && f) const
+    {
+        if (!is_mapped())
+        {
+            for (auto const & ac_lineage : ac__taxid)
+                f(&ac_lineage.second[0]);
+            return;
+        }
+        uint32_t const * lineages = _section<uint32_t>(_header->lineages);
+        for (uint64_t i = 0; i < _header->accessions_count; ++i)
+            f(lineages + i * LINAGE_LENGTH);
+    }
+
+    inline taxa_ranks rank_of(uint32_t const taxid) const
+    {
+        if (!is_mapped())
+        {
+            auto tid_pos = taxid__name.find(taxid);
+            if (tid_pos == taxid__name.end())
+                return strain_lv;
+            return std::get<0>(tid_pos->second);
+        }
+        int64_t index = _find_taxon(taxid);
+        if (index == -1)
+            return strain_lv;
+        return static_cast<taxa_ranks>(_section<uint8_t>(_header->taxa_ranks)[index]);
+    }
+
+    inline std::string name_of(uint32_t const taxid) const
+    {
+        if (!is_mapped())
+        {
+            auto tid_pos = taxid__name.find(taxid);
+            if (tid_pos == taxid__name.end())
+                return "";
+            return std::get<1>(tid_pos->second);
+        }
+        int64_t index = _find_taxon(taxid);
+        if (index == -1)
+            return "";
+        uint64_t const * offsets = _section<uint64_t>(_header->name_offsets);
+        return std::string(_section<char>(_header->name_pool) + offsets[index], offsets[index + 1] - offsets[index]);
+    }
+
+    // use a version 2 database file in place
+    bool map(std::string const & input_path)
+    {
+        std::shared_ptr<mapped_file> file = std::make_shared<mapped_file>();
+        if (!file->open(input_path) || file->size() < sizeof(sldb_v2_header))
+            return false;
+
+        sldb_v2_header const * header = reinterpret_cast<sldb_v2_header const *>(file->data());
+        if (std::memcmp(header->magic, SLDB_V2_MAGIC, sizeof(SLDB_V2_MAGIC)) != 0 ||
+            header->byte_order != SLDB_BYTE_ORDER ||
+            header->lineage_length != LINAGE_LENGTH ||
+            header->file_size != file->size() ||
+            header->name_pool > header->file_size)
+            return false;
+
+        ac__taxid.clear();
+        taxid__name.clear();
+        _file = file;
+        _header = header;
+        return true;
+    }
+
+    // copies a mapped database into the maps (e.g. to extend it) and releases the file
+    void unmap()
+    {
+        if (!is_mapped())
+            return;
+
+        uint64_t const * offsets = _section<uint64_t>(_header->accession_offsets);
+        char const * pool = _section<char>(_header->accession_pool);
+        uint32_t const * lineages = _section<uint32_t>(_header->lineages);
+        ac__taxid.reserve(_header->accessions_count);
+        for (uint64_t i = 0; i < _header->accessions_count; ++i)
+        {
+            ac__taxid.emplace(std::string(pool + offsets[i], offsets[i + 1] - offsets[i]),
+                              std::vector<uint32_t>(lineages + i * LINAGE_LENGTH, lineages + (i + 1) * LINAGE_LENGTH));
+        }
+
+        uint32_t const * taxa_ids = _section<uint32_t>(_header->taxa_ids);
+        uint8_t const * ranks = _section<uint8_t>(_header->taxa_ranks);
+        uint64_t const * name_offsets = _section<uint64_t>(_header->name_offsets);
+        char const * name_pool = _section<char>(_header->name_pool);
+        taxid__name.reserve(_header->taxa_count);
+        for (uint64_t i = 0; i < _header->taxa_count; ++i)
+        {
+            std::string name(name_pool + name_offsets[i], name_offsets[i + 1] - name_offsets[i]);
+            taxid__name[taxa_ids[i]] = std::make_tuple(static_cast<taxa_ranks>(ranks[i]), name);
+        }
+
+        _header = nullptr;
+        _file.reset();
+    }
+
     template <class Archive>
     void save( Archive & ar ) const
     {
@@ -97,6 +372,104 @@ public:
         ar(taxid__name);
     }
 
+private:
+    std::shared_ptr<mapped_file>        _file;
+    sldb_v2_header const *              _header = nullptr;
+
+    template <typename TValue>
+    inline TValue const * _section(uint64_t const offset) const
+    {
+        return reinterpret_cast<TValue const *>(_file->data() + offset);
+    }
+
+    inline static int _compare(char const * key, uint64_t const key_length, std::string const & accession)
+    {
+        int cmp = std::memcmp(key, accession.data(), std::min<uint64_t>(key_length, accession.size()));
+        if (cmp != 0)
+            return cmp;
+        return key_length < accession.size() ? -1 : (key_length > accession.size() ? 1 : 0);
+    }
+
+    inline int64_t _find_taxon(uint32_t const taxid) const
+    {
+        uint32_t const * first = _section<uint32_t>(_header->taxa_ids);
+        uint32_t const * last = first + _header->taxa_count;
+        uint32_t const * pos = std::lower_bound(first, last, taxid);
+        if (pos == last || *pos != taxid)
+            return -1;
+        return pos - first;
+    }
+};
+
+// --------------------------------------------------------------------------
+// Function fingerprint_64()
+// --------------------------------------------------------------------------
+// MurmurHash64A by Austin Appleby. A fast 64-bit hash with good avalanche
+// behaviour, used to fingerprint read names instead of storing them.
+inline uint64_t fingerprint_64(char const * data, size_t len, uint64_t seed = 0)
+{
+    uint64_t const m = 0xc6a4a7935bd1e995ULL;
+    int const      r = 47;
+    uint64_t       h = seed ^ (len * m);
+
+    char const * end = data + (len / 8) * 8;
+    for (; data != end; data += 8)
+    {
+        uint64_t k;
+        std::memcpy(&k, data, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7)
+    {
+        case 7: h ^= uint64_t(static_cast<unsigned char>(data[6])) << 48;
+                // fall through
+        case 6: h ^= uint64_t(static_cast<unsigned char>(data[5])) << 40;
+                // fall through
+        case 5: h ^= uint64_t(static_cast<unsigned char>(data[4])) << 32;
+                // fall through
+        case 4: h ^= uint64_t(static_cast<unsigned char>(data[3])) << 24;
+                // fall through
+        case 3: h ^= uint64_t(static_cast<unsigned char>(data[2])) << 16;
+                // fall through
+        case 2: h ^= uint64_t(static_cast<unsigned char>(data[1])) << 8;
+                // fall through
+        case 1: h ^= uint64_t(static_cast<unsigned char>(data[0]));
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+// --------------------------------------------------------------------------
+// Function read_fingerprint()
+// --------------------------------------------------------------------------
+// Fingerprint of a read name and its mate number (0 unpaired, 1 first, 2 last).
+// The mate is used as seed so both mates get unrelated fingerprints.
+// For n distinct reads the probability that any two of them share a
+// fingerprint is about n^2 / 2^65, e.g. 3e-4 for 1e8 reads and 3e-2 for 1e9
+// reads. Colliding reads are merged, i.e. their targets are combined.
+inline uint64_t read_fingerprint(CharString const & read_name, uint32_t const mate)
+{
+    if (length(read_name) == 0)
+        return fingerprint_64(nullptr, 0, mate);
+    return fingerprint_64(&read_name[0], length(read_name), mate);
+}
+
+// fingerprints are already well mixed, no need to hash them again
+struct fingerprint_hash
+{
+    inline size_t operator()(uint64_t const fingerprint) const
+    {
+        return fingerprint;
+    }
 };
 
 template <typename TTarget, typename TString, typename TKey = uint32_t, typename TValue = uint32_t>
@@ -175,6 +548,7 @@ TNodes load_node_maps(std::string const & filePath)
 // --------------------------------------------------------------------------
 // Function save_slimm_database()
 // --------------------------------------------------------------------------
+// writes the version 1 (cereal) format
 inline void save_slimm_database(slimm_database const & slimm_db, std::string const & output_path)
 {
     std::ofstream os(output_path, std::ios::binary);
@@ -183,11 +557,123 @@ inline void save_slimm_database(slimm_database const & slimm_db, std::string con
     os.close();
 }
 
+// --------------------------------------------------------------------------
+// Function save_slimm_database_v2()
+// --------------------------------------------------------------------------
+// writes the version 2 format (see sldb_v2_header) of an in-memory database
+inline void save_slimm_database_v2(slimm_database const & slimm_db, std::string const & output_path)
+{
+    auto aligned = [](uint64_t size) { return (size + 7) / 8 * 8; };
+
+    std::vector<std::string const *> accessions;
+    accessions.reserve(slimm_db.ac__taxid.size());
+    uint64_t accession_pool_size = 0;
+    for (auto const & ac_lineage : slimm_db.ac__taxid)
+    {
+        accessions.push_back(&ac_lineage.first);
+        accession_pool_size += ac_lineage.first.size();
+    }
+    std::sort(accessions.begin(), accessions.end(),
+              [](std::string const * a, std::string const * b) { return *a < *b; });
+
+    std::vector<uint32_t> taxa_ids;
+    taxa_ids.reserve(slimm_db.taxid__name.size());
+    uint64_t name_pool_size = 0;
+    for (auto const & taxon : slimm_db.taxid__name)
+    {
+        taxa_ids.push_back(taxon.first);
+        name_pool_size += std::get<1>(taxon.second).size();
+    }
+    std::sort(taxa_ids.begin(), taxa_ids.end());
+
+    sldb_v2_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SLDB_V2_MAGIC, sizeof(SLDB_V2_MAGIC));
+    header.byte_order           = SLDB_BYTE_ORDER;
+    header.lineage_length       = LINAGE_LENGTH;
+    header.accessions_count     = accessions.size();
+    header.taxa_count           = taxa_ids.size();
+    header.accession_offsets    = aligned(sizeof(header));
+    header.accession_pool       = header.accession_offsets + (accessions.size() + 1) * sizeof(uint64_t);
+    header.lineages             = header.accession_pool + aligned(accession_pool_size);
+    header.taxa_ids             = header.lineages + accessions.size() * LINAGE_LENGTH * sizeof(uint32_t);
+    header.taxa_ranks           = header.taxa_ids + aligned(taxa_ids.size() * sizeof(uint32_t));
+    header.name_offsets         = header.taxa_ranks + aligned(taxa_ids.size());
+    header.name_pool            = header.name_offsets + (taxa_ids.size() + 1) * sizeof(uint64_t);
+    header.file_size            = header.name_pool + aligned(name_pool_size);
+
+    std::ofstream os(output_path, std::ios::binary);
+    auto write = [&os](void const * data, uint64_t size) { os.write(static_cast<char const *>(data), size); };
+    auto pad = [&os]() { while (os.tellp() % 8 != 0) os.put('\0'); };
+
+    write(&header, sizeof(header));
+    pad();
+
+    uint64_t offset = 0;
+    write(&offset, sizeof(offset));
+    for (auto accession : accessions)
+    {
+        offset += accession->size();
+        write(&offset, sizeof(offset));
+    }
+    for (auto accession : accessions)
+        write(accession->data(), accession->size());
+    pad();
+    for (auto accession : accessions)
+    {
+        uint32_t lineage[LINAGE_LENGTH] = {0};
+        std::vector<uint32_t> const & taxa = slimm_db.ac__taxid.at(*accession);
+        std::copy(taxa.begin(), taxa.begin() + std::min<size_t>(taxa.size(), LINAGE_LENGTH), lineage);
+        write(lineage, sizeof(lineage));
+    }
+
+    write(taxa_ids.data(), taxa_ids.size() * sizeof(uint32_t));
+    pad();
+    for (auto taxid : taxa_ids)
+        os.put(static_cast<char>(std::get<0>(slimm_db.taxid__name.at(taxid))));
+    pad();
+
+    offset = 0;
+    write(&offset, sizeof(offset));
+    for (auto taxid : taxa_ids)
+    {
+        offset += std::get<1>(slimm_db.taxid__name.at(taxid)).size();
+        write(&offset, sizeof(offset));
+    }
+    for (auto taxid : taxa_ids)
+    {
+        std::string const & name = std::get<1>(slimm_db.taxid__name.at(taxid));
+        write(name.data(), name.size());
+    }
+    pad();
+    os.close();
+}
+
+// --------------------------------------------------------------------------
+// Function is_slimm_database_v2()
+// --------------------------------------------------------------------------
+inline bool is_slimm_database_v2(std::string const & input_path)
+{
+    char magic[sizeof(SLDB_V2_MAGIC)] = {0};
+    std::ifstream is(input_path, std::ios::binary);
+    return is.read(magic, sizeof(magic)) && std::memcmp(magic, SLDB_V2_MAGIC, sizeof(magic)) == 0;
+}
+
 // --------------------------------------------------------------------------
 // Function load_slimm_database()
 // --------------------------------------------------------------------------
+// version 2 databases are mapped, version 1 databases are deserialized
 inline void load_slimm_database(slimm_database & slimm_db, std::string const & input_path)
 {
+    if (is_slimm_database_v2(input_path))
+    {
+        if (!slimm_db.map(input_path))
+        {
+            std::cerr << "[ERROR] " << input_path << " is not a valid SLIMM database!\n";
+            exit(1);
+        }
+        return;
+    }
     std::ifstream is(input_path, std::ios::binary);
     cereal::BinaryInputArchive in_archive(is);
     in_archive(slimm_db);
@@ -412,13 +898,25 @@ uint32_t getLCA(std::set<uint32_t> const & taxon_ids, std::set<uint32_t> const &
     return *(parents.begin());
 }
 
+// length of the accession at the start of a sequence name, i.e. the part
+// before the first whitespace, '.' (version) or '|'
+inline size_t accession_length(char const * sequence_name, size_t const name_length)
+{
+    for (size_t i = 0; i < name_length; ++i)
+    {
+        char c = sequence_name[i];
+        if (c == '.' || c == '|' || c == ' ' || (c >= '\t' && c <= '\r'))
+            return i;
+    }
+    return name_length;
+}
+
 std::string get_accession_id(CharString const & sequence_name)
 {
-    typedef OrFunctor<IsWhitespace, OrFunctor<EqualsChar<'.'> , EqualsChar<'|'> > >  IsSeqNameDelim;
-    StringSet <CharString> chunks;
-    strSplit(chunks, sequence_name, IsSeqNameDelim());
-    std::string result = toCString(chunks[0]);
-    return result;
+    if (length(sequence_name) == 0)
+        return "";
+    char const * name = &sequence_name[0];
+    return std::string(name, accession_length(name, length(sequence_name)));
 }
 
 
@@ -455,27 +953,113 @@ uint32_t getLCA(std::vector<uint32_t> const & taxon_ids, TNodes const & nodes)
 }
 
 
-uint32_t get_lca(std::set<uint32_t> const & taxon_ids, std::set<uint32_t> const & valid_taxon_ids, slimm_database const & slimm_db)
+// --------------------------------------------------------------------------
+// Function get_thread_num()
+// --------------------------------------------------------------------------
+// the id of the calling thread inside an OpenMP parallel region
+inline uint32_t get_thread_num()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// the number of threads of the team running the current parallel region,
+// it can be smaller than requested (OMP_DYNAMIC, OMP_THREAD_LIMIT, ...)
+inline uint32_t get_num_threads()
+{
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
+
+// the number of threads a parallel region can actually use
+inline uint32_t get_usable_threads(uint32_t threads)
 {
-    std::vector<std::set<uint32_t> > taxa_rank_set;
-    taxa_rank_set.resize(LINAGE_LENGTH);
+#ifdef _OPENMP
+    return std::max<uint32_t>(threads, 1);
+#else
+    (void)threads;
+    return 1;
+#endif
+}
+
+// --------------------------------------------------------------------------
+// Function first_common_rank()
+// --------------------------------------------------------------------------
+// Compares the lineages (LINAGE_LENGTH taxa ids each) of count references and
+// returns the lowest rank at which all of them have the same taxon, or
+// LINAGE_LENGTH if there is none. row(i) gives the lineage of the i-th
+// reference. Nothing is allocated.
+template <typename TRow>
+inline uint32_t first_common_rank(size_t const count, TRow && row)
+{
+    if (count == 0)
+        return LINAGE_LENGTH;
 
-    for(auto ac__taxid_it=slimm_db.ac__taxid.begin(); ac__taxid_it != slimm_db.ac__taxid.end(); ++ac__taxid_it)
+    uint32_t const * first = row(0);
+    uint32_t agree_mask = (1u << LINAGE_LENGTH) - 1;    // bit i: rank i agrees so far
+
+#if defined(__AVX2__)
+    __m256i const first_v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(first));
+    __m256i equal_v = _mm256_set1_epi32(-1);
+    for (size_t i = 1; i < count; ++i)
+    {
+        __m256i row_v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(row(i)));
+        equal_v = _mm256_and_si256(equal_v, _mm256_cmpeq_epi32(first_v, row_v));
+        // stop as soon as no rank can agree any more
+        if ((i & 7) == 0 && _mm256_testz_si256(equal_v, equal_v))
+            return LINAGE_LENGTH;
+    }
+    agree_mask = _mm256_movemask_ps(_mm256_castsi256_ps(equal_v));
+#elif defined(__SSE2__)
+    __m128i const first_lo = _mm_loadu_si128(reinterpret_cast<__m128i const *>(first));
+    __m128i const first_hi = _mm_loadu_si128(reinterpret_cast<__m128i const *>(first + 4));
+    __m128i equal_lo = _mm_set1_epi32(-1);
+    __m128i equal_hi = _mm_set1_epi32(-1);
+    for (size_t i = 1; i < count; ++i)
     {
-        uint32_t tid = ac__taxid_it->second[0];
-        if(taxon_ids.find(tid) != taxon_ids.end())
+        uint32_t const * current = row(i);
+        equal_lo = _mm_and_si128(equal_lo, _mm_cmpeq_epi32(first_lo, _mm_loadu_si128(reinterpret_cast<__m128i const *>(current))));
+        equal_hi = _mm_and_si128(equal_hi, _mm_cmpeq_epi32(first_hi, _mm_loadu_si128(reinterpret_cast<__m128i const *>(current + 4))));
+    }
+    agree_mask = _mm_movemask_ps(_mm_castsi128_ps(equal_lo)) | (_mm_movemask_ps(_mm_castsi128_ps(equal_hi)) << 4);
+#else
+    for (size_t i = 1; i < count && agree_mask != 0; ++i)
+    {
+        uint32_t const * current = row(i);
+        for (uint32_t r = 0; r < LINAGE_LENGTH; ++r)
         {
-            for (uint32_t i=0; i<LINAGE_LENGTH; ++i)
-            {
-                taxa_rank_set[i].insert(ac__taxid_it->second[i]);
-            }
+            if (current[r] != first[r])
+                agree_mask &= ~(1u << r);
         }
     }
-    for (uint32_t i=0; i<LINAGE_LENGTH; ++i)
+#endif
+
+    for (uint32_t r = 0; r < LINAGE_LENGTH; ++r)
     {
-        if (taxa_rank_set[i].size() == 1)
-            return *(taxa_rank_set[i].begin());
+        if (agree_mask & (1u << r))
+            return r;
     }
+    return LINAGE_LENGTH;
+}
+
+uint32_t get_lca(std::set<uint32_t> const & taxon_ids, std::set<uint32_t> const & valid_taxon_ids, slimm_database const & slimm_db)
+{
+    std::vector<uint32_t const *> linages;
+    slimm_db.for_each_lineage([&](uint32_t const * linage)
+    {
+        if(taxon_ids.find(linage[0]) != taxon_ids.end())
+            linages.push_back(linage);
+    });
+
+    uint32_t rank = first_common_rank(linages.size(), [&linages](size_t i) { return linages[i]; });
+    if (rank < LINAGE_LENGTH)
+        return linages[0][rank];
     return 1;
 }
 
@@ -506,6 +1090,39 @@ inline bool read_bam_file(BamFileIn & bam_file, BamHeader & bam_header, std::str
     return true;
 }
 
+// checks if the header declares the records as sorted or grouped by read name
+inline bool is_query_grouped(BamHeader const & bam_header)
+{
+    for (uint32_t i = 0; i < length(bam_header); ++i)
+    {
+        if (bam_header[i].type != BAM_HEADER_FIRST)
+            continue;
+        for (uint32_t j = 0; j < length(bam_header[i].tags); ++j)
+        {
+            if ((bam_header[i].tags[j].i1 == "SO" && bam_header[i].tags[j].i2 == "queryname") ||
+                (bam_header[i].tags[j].i1 == "GO" && bam_header[i].tags[j].i2 == "query"))
+                return true;
+        }
+    }
+    return false;
+}
+
+// checks if the header declares the records as sorted by coordinate
+inline bool is_coordinate_sorted(BamHeader const & bam_header)
+{
+    for (uint32_t i = 0; i < length(bam_header); ++i)
+    {
+        if (bam_header[i].type != BAM_HEADER_FIRST)
+            continue;
+        for (uint32_t j = 0; j < length(bam_header[i].tags); ++j)
+        {
+            if (bam_header[i].tags[j].i1 == "SO" && bam_header[i].tags[j].i2 == "coordinate")
+                return true;
+        }
+    }
+    return false;
+}
+
 inline uint32_t get_avg_read_length(BamFileIn & bam_file, uint32_t const sample_size)
 {
     BamAlignmentRecord record;
@@ -0,0 +1,314 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef PROFILE_MATRIX_H
+#define PROFILE_MATRIX_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace seqan;
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class profile_row
+// ----------------------------------------------------------------------------
+// a line of a taxonomic profile (_profile.tsv)
+class profile_row
+{
+public:
+    taxa_ranks                  rank;
+    // the taxon id, "<taxon id>*" for the unclassified part of a taxon
+    std::string                 taxa_id;
+    std::string                 linage;
+    double                      abundance;
+    uint32_t                    reads_count;
+
+    profile_row(taxa_ranks r, std::string const & t_id, std::string const & l, double ab, uint32_t count):
+                        rank(r), taxa_id(t_id), linage(l), abundance(ab), reads_count(count) {}
+};
+
+// ----------------------------------------------------------------------------
+// Class profile_matrix_header
+// ----------------------------------------------------------------------------
+// Layout of the binary sample x taxon matrix (.slmx). All sections are 8-byte
+// aligned arrays in native byte order. The entries of a taxon are stored next
+// to each other (compressed sparse rows) in increasing sample order:
+//   sample_offsets     (samples_count + 1) x uint64  offsets into sample_pool
+//   sample_pool        the sample names
+//   taxa_ranks         taxa_count x uint8
+//   taxa_id_offsets    (taxa_count + 1) x uint64  offsets into taxa_id_pool
+//   taxa_id_pool       the taxa ids as in the profiles (e.g. "1234" or "1234*")
+//   linage_offsets     (taxa_count + 1) x uint64  offsets into linage_pool
+//   linage_pool        the linages of the taxa
+//   row_offsets        (taxa_count + 1) x uint64  the first entry of each taxon
+//   entry_samples      entries_count x uint32
+//   entry_abundances   entries_count x float
+//   entry_reads        entries_count x uint32
+char const      PROFILE_MATRIX_MAGIC[8]    = {'S', 'L', 'M', 'X', '\0', 'v', '1', '\0'};
+
+struct profile_matrix_header
+{
+    char        magic[8];
+    uint32_t    byte_order;
+    uint32_t    reserved;
+    uint64_t    samples_count;
+    uint64_t    taxa_count;
+    uint64_t    entries_count;
+    uint64_t    sample_offsets;
+    uint64_t    sample_pool;
+    uint64_t    taxa_ranks;
+    uint64_t    taxa_id_offsets;
+    uint64_t    taxa_id_pool;
+    uint64_t    linage_offsets;
+    uint64_t    linage_pool;
+    uint64_t    row_offsets;
+    uint64_t    entry_samples;
+    uint64_t    entry_abundances;
+    uint64_t    entry_reads;
+    uint64_t    file_size;
+};
+
+// ----------------------------------------------------------------------------
+// Class profile_matrix
+// ----------------------------------------------------------------------------
+// The profiles of many samples merged into a sparse sample x taxon matrix.
+// Profiles can be added from several threads as the samples are done.
+class profile_matrix
+{
+public:
+    explicit profile_matrix(std::vector<std::string> const & sample_names): _samples(sample_names) {}
+
+    void add(uint32_t const sample, std::vector<profile_row> const & rows)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (profile_row const & row : rows)
+        {
+            std::string key = from_taxa_ranks(row.rank) + "\t" + row.taxa_id;
+            auto inserted = _taxon_index.emplace(key, _taxa.size());
+            if (inserted.second)
+                _taxa.push_back(_taxon{row.rank, row.taxa_id, row.linage});
+            _entries.push_back(_entry{inserted.first->second, sample, row.abundance, row.reads_count});
+        }
+    }
+
+    // one line per taxon and one abundance column per sample
+    bool write_tsv(std::string const & tsv_path)
+    {
+        std::ofstream tsv_stream(tsv_path);
+        if (!tsv_stream.is_open())
+            return false;
+
+        _sort();
+        tsv_stream << "taxa_level\ttaxa_id\tlinage";
+        for (std::string const & sample : _samples)
+            tsv_stream << "\t" << sample;
+        tsv_stream << "\n";
+
+        auto entry_it = _entries.begin();
+        for (uint32_t t : _taxa_order)
+        {
+            tsv_stream << from_taxa_ranks(_taxa[t].rank) << "\t" << _taxa[t].taxa_id << "\t" << _taxa[t].linage;
+            for (uint32_t s = 0; s < _samples.size(); ++s)
+            {
+                tsv_stream << "\t";
+                if (entry_it != _entries.end() && entry_it->taxon == t && entry_it->sample == s)
+                    tsv_stream << (entry_it++)->abundance;
+                else
+                    tsv_stream << 0;
+            }
+            tsv_stream << "\n";
+        }
+        return tsv_stream.good();
+    }
+
+    // the compact binary layout described at profile_matrix_header
+    bool write_binary(std::string const & binary_path)
+    {
+        std::ofstream os(binary_path, std::ios::binary);
+        if (!os.is_open())
+            return false;
+
+        _sort();
+        auto aligned = [](uint64_t size) { return (size + 7) / 8 * 8; };
+        uint64_t sample_pool_size = 0, taxa_id_pool_size = 0, linage_pool_size = 0;
+        for (std::string const & sample : _samples)
+            sample_pool_size += sample.size();
+        for (_taxon const & taxon : _taxa)
+        {
+            taxa_id_pool_size += taxon.taxa_id.size();
+            linage_pool_size += taxon.linage.size();
+        }
+
+        profile_matrix_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, PROFILE_MATRIX_MAGIC, sizeof(PROFILE_MATRIX_MAGIC));
+        header.byte_order       = SLDB_BYTE_ORDER;
+        header.samples_count    = _samples.size();
+        header.taxa_count       = _taxa.size();
+        header.entries_count    = _entries.size();
+        header.sample_offsets   = aligned(sizeof(header));
+        header.sample_pool      = header.sample_offsets + (_samples.size() + 1) * sizeof(uint64_t);
+        header.taxa_ranks       = header.sample_pool + aligned(sample_pool_size);
+        header.taxa_id_offsets  = header.taxa_ranks + aligned(_taxa.size());
+        header.taxa_id_pool     = header.taxa_id_offsets + (_taxa.size() + 1) * sizeof(uint64_t);
+        header.linage_offsets   = header.taxa_id_pool + aligned(taxa_id_pool_size);
+        header.linage_pool      = header.linage_offsets + (_taxa.size() + 1) * sizeof(uint64_t);
+        header.row_offsets      = header.linage_pool + aligned(linage_pool_size);
+        header.entry_samples    = header.row_offsets + (_taxa.size() + 1) * sizeof(uint64_t);
+        header.entry_abundances = header.entry_samples + aligned(_entries.size() * sizeof(uint32_t));
+        header.entry_reads      = header.entry_abundances + aligned(_entries.size() * sizeof(float));
+        header.file_size        = header.entry_reads + aligned(_entries.size() * sizeof(uint32_t));
+
+        auto write = [&os](void const * data, uint64_t size) { os.write(static_cast<char const *>(data), size); };
+        auto pad = [&os]() { while (os.tellp() % 8 != 0) os.put('\0'); };
+        auto write_strings = [&write, &pad](std::vector<std::string const *> const & strings)
+        {
+            uint64_t offset = 0;
+            write(&offset, sizeof(offset));
+            for (std::string const * str : strings)
+            {
+                offset += str->size();
+                write(&offset, sizeof(offset));
+            }
+            for (std::string const * str : strings)
+                write(str->data(), str->size());
+            pad();
+        };
+
+        write(&header, sizeof(header));
+        pad();
+
+        std::vector<std::string const *> strings;
+        for (std::string const & sample : _samples)
+            strings.push_back(&sample);
+        write_strings(strings);
+
+        for (uint32_t t : _taxa_order)
+            os.put(static_cast<char>(_taxa[t].rank));
+        pad();
+
+        strings.clear();
+        for (uint32_t t : _taxa_order)
+            strings.push_back(&_taxa[t].taxa_id);
+        write_strings(strings);
+
+        strings.clear();
+        for (uint32_t t : _taxa_order)
+            strings.push_back(&_taxa[t].linage);
+        write_strings(strings);
+
+        // the entries are sorted by taxon (in output order) and sample
+        uint64_t offset = 0;
+        write(&offset, sizeof(offset));
+        auto entry_it = _entries.begin();
+        for (uint32_t t : _taxa_order)
+        {
+            for (; entry_it != _entries.end() && entry_it->taxon == t; ++entry_it)
+                ++offset;
+            write(&offset, sizeof(offset));
+        }
+        for (_entry const & entry : _entries)
+            write(&entry.sample, sizeof(uint32_t));
+        pad();
+        for (_entry const & entry : _entries)
+        {
+            float abundance = entry.abundance;
+            write(&abundance, sizeof(float));
+        }
+        pad();
+        for (_entry const & entry : _entries)
+            write(&entry.reads_count, sizeof(uint32_t));
+        pad();
+        return os.good();
+    }
+
+private:
+    struct _taxon
+    {
+        taxa_ranks              rank;
+        std::string             taxa_id;
+        std::string             linage;
+    };
+
+    struct _entry
+    {
+        uint32_t                taxon;
+        uint32_t                sample;
+        double                  abundance;
+        uint32_t                reads_count;
+    };
+
+    std::mutex                                  _mutex;
+    std::vector<std::string>                    _samples;
+    std::vector<_taxon>                         _taxa;
+    std::unordered_map<std::string, uint32_t>   _taxon_index;
+    std::vector<_entry>                         _entries;
+    // the order of the taxa in the output: by rank (highest first), linage and id
+    std::vector<uint32_t>                       _taxa_order;
+
+    // sorts the taxa for the output and the entries in the same order
+    void _sort()
+    {
+        _taxa_order.resize(_taxa.size());
+        for (uint32_t t = 0; t < _taxa.size(); ++t)
+            _taxa_order[t] = t;
+        std::sort(_taxa_order.begin(), _taxa_order.end(), [this](uint32_t a, uint32_t b)
+        {
+            if (_taxa[a].rank != _taxa[b].rank)
+                return _taxa[a].rank > _taxa[b].rank;
+            if (_taxa[a].linage != _taxa[b].linage)
+                return _taxa[a].linage < _taxa[b].linage;
+            return _taxa[a].taxa_id < _taxa[b].taxa_id;
+        });
+
+        std::vector<uint32_t> position(_taxa.size());
+        for (uint32_t i = 0; i < _taxa_order.size(); ++i)
+            position[_taxa_order[i]] = i;
+        std::sort(_entries.begin(), _entries.end(), [&position](_entry const & a, _entry const & b)
+        {
+            if (a.taxon != b.taxon)
+                return position[a.taxon] < position[b.taxon];
+            return a.sample < b.sample;
+        });
+    }
+};
+
+#endif /* PROFILE_MATRIX_H */
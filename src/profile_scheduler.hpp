@@ -0,0 +1,259 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef PROFILE_SCHEDULER_H
+#define PROFILE_SCHEDULER_H
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function get_physical_memory()
+// --------------------------------------------------------------------------
+// returns the installed memory in bytes or 0 if it can not be determined
+inline uint64_t get_physical_memory()
+{
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0)
+        return uint64_t(pages) * uint64_t(page_size);
+#endif
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function is_bam_path()
+// --------------------------------------------------------------------------
+// true if the file name (not the directories above it) ends with .bam
+inline bool is_bam_path(std::string const & file_path)
+{
+    std::string file_name = get_file_name(file_path);
+    size_t dot_pos = file_name.find_last_of('.');
+    return dot_pos != std::string::npos && file_name.compare(dot_pos, std::string::npos, ".bam") == 0;
+}
+
+// --------------------------------------------------------------------------
+// Function estimate_profile_memory()
+// --------------------------------------------------------------------------
+// A rough upper bound of the memory needed to profile a SAM/BAM file. The
+// per read state grows with the number of records, i.e. with the file size.
+// BAM records are compressed about 3-4 fold, SAM records are plain text and
+// a state file is loaded as it is, then copied once for the interim profiles.
+inline uint64_t estimate_profile_memory(std::string const & file_path)
+{
+    uint64_t file_size = get_file_size(file_path);
+    if (is_state_file(file_path) || is_bam_path(file_path))
+        return 2 * file_size;
+    return file_size / 2;
+}
+
+// --------------------------------------------------------------------------
+// Function estimate_records_count()
+// --------------------------------------------------------------------------
+// A generous guess of the number of records in a SAM/BAM file, used to size
+// the read table. A compressed BAM record takes roughly as many bytes as the
+// read is long (4 bit bases plus qualities), a SAM record about 3 times that.
+inline uint64_t estimate_records_count(std::string const & file_path, uint32_t avg_read_length)
+{
+    uint64_t file_size = get_file_size(file_path);
+    if (avg_read_length == 0)
+        return 0;
+    if (is_bam_path(file_path))
+        return file_size / avg_read_length;
+    return file_size / (3 * avg_read_length);
+}
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class profile_scheduler
+// ----------------------------------------------------------------------------
+// Profiles several SAM/BAM files at once. Files are queued largest first so a
+// single huge sample does not end up running alone at the end. Every worker
+// picks the largest queued file whose estimated memory still fits into the
+// budget; if nothing fits it waits for a running file to finish. A file is
+// always started when nothing else is running, even if it exceeds the budget.
+class profile_scheduler
+{
+public:
+    profile_scheduler(uint32_t jobs, uint64_t memory_budget):
+                        _jobs(std::max(jobs, 1u)),
+                        _memory_budget(memory_budget) {}
+
+    // calls job(file_index) for every file in file_paths and returns the
+    // indices of the files whose job returned false or threw an exception
+    template <typename TJob>
+    std::vector<uint32_t> run(std::vector<std::string> const & file_paths, TJob job)
+    {
+        _failed.clear();
+        _queue.clear();
+        for (uint32_t i = 0; i < file_paths.size(); ++i)
+            _queue.push_back(std::make_pair(estimate_profile_memory(file_paths[i]), i));
+        std::stable_sort(_queue.begin(), _queue.end(),
+                         [](std::pair<uint64_t, uint32_t> const & a, std::pair<uint64_t, uint32_t> const & b)
+                         {
+                             return a.first > b.first;
+                         });
+
+        uint32_t workers_count = std::min<uint32_t>(_jobs, _queue.size());
+        if (workers_count <= 1)
+        {
+            for (auto const & file : _queue)
+                _run_job(file_paths, file.second, job);
+            std::sort(_failed.begin(), _failed.end());
+            return _failed;
+        }
+
+        std::vector<std::thread> workers;
+        for (uint32_t w = 0; w < workers_count; ++w)
+        {
+            workers.emplace_back([this, &file_paths, &job]()
+            {
+                std::pair<uint64_t, uint32_t> file;
+                while (_acquire(file))
+                {
+                    _run_job(file_paths, file.second, job);
+                    _release(file);
+                }
+            });
+        }
+        for (auto & worker : workers)
+            worker.join();
+        std::sort(_failed.begin(), _failed.end());
+        return _failed;
+    }
+
+    // for jobs that arrive one at a time (slimm serve): blocks until a job
+    // with the given memory estimate can start under the same rules as above
+    void admit(uint64_t const memory)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_running > 0 &&
+               (_running >= _jobs || (_memory_budget > 0 && _memory_in_use + memory > _memory_budget)))
+            _finished.wait(lock);
+        _memory_in_use += memory;
+        ++_running;
+    }
+
+    // a job started with admit() is done
+    void release(uint64_t const memory)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _memory_in_use -= memory;
+            --_running;
+        }
+        _finished.notify_all();
+    }
+
+private:
+    uint32_t                                        _jobs;
+    uint64_t                                        _memory_budget;
+    uint64_t                                        _memory_in_use = 0;
+    uint32_t                                        _running = 0;
+    std::vector<std::pair<uint64_t, uint32_t> >     _queue;
+    std::vector<uint32_t>                           _failed;
+    std::mutex                                      _mutex;
+    std::condition_variable                         _finished;
+
+    // an exception of one file must not take down the other workers
+    template <typename TJob>
+    inline void _run_job(std::vector<std::string> const & file_paths, uint32_t const file_index, TJob & job)
+    {
+        bool ok = false;
+        try
+        {
+            ok = job(file_index);
+        }
+        catch (std::exception const & e)
+        {
+            std::cerr << "[ERROR] " << file_paths[file_index] << ": " << e.what() << "\n";
+        }
+        catch (char const * message)
+        {
+            std::cerr << "[ERROR] " << file_paths[file_index] << ": " << message << "\n";
+        }
+        if (!ok)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _failed.push_back(file_index);
+        }
+    }
+
+    // takes the largest queued file that fits, returns false if the queue is empty
+    inline bool _acquire(std::pair<uint64_t, uint32_t> & file)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_queue.empty())
+        {
+            auto it = _queue.begin();
+            if (_memory_budget > 0 && _running > 0)
+            {
+                while (it != _queue.end() && _memory_in_use + it->first > _memory_budget)
+                    ++it;
+            }
+            if (it != _queue.end())
+            {
+                file = *it;
+                _queue.erase(it);
+                _memory_in_use += file.first;
+                ++_running;
+                return true;
+            }
+            _finished.wait(lock);
+        }
+        return false;
+    }
+
+    inline void _release(std::pair<uint64_t, uint32_t> const & file)
+    {
+        release(file.first);
+    }
+};
+
+#endif /* PROFILE_SCHEDULER_H */
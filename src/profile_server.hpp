@@ -0,0 +1,276 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef PROFILE_SERVER_H
+#define PROFILE_SERVER_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#ifndef _WIN32
+    #include <poll.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+// how often (in milliseconds) blocked sockets look whether the server stops
+int const SERVER_POLL_INTERVAL = 200;
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function split_request()
+// --------------------------------------------------------------------------
+// splits a request line into its whitespace separated words
+inline std::vector<std::string> split_request(std::string const & line)
+{
+    std::vector<std::string> words;
+    size_t end = 0;
+    while (true)
+    {
+        size_t begin = line.find_first_not_of(" \t\r", end);
+        if (begin == std::string::npos)
+            break;
+        end = line.find_first_of(" \t\r", begin);
+        words.push_back(line.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+    }
+    return words;
+}
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class profile_server
+// ----------------------------------------------------------------------------
+// A line based server on a local (Unix domain) socket. Every connection is
+// served by its own thread which answers each request line with the single
+// line returned by the handler. The request SHUTDOWN stops the server once
+// the requests in progress are answered.
+class profile_server
+{
+public:
+    profile_server(std::string const & socket_path): _socket_path(socket_path) {}
+
+    ~profile_server()
+    {
+        close();
+    }
+
+    profile_server(profile_server const &) = delete;
+    profile_server & operator=(profile_server const &) = delete;
+
+    // binds the socket, a socket file left over by an earlier server is replaced
+    // but anything else at the socket path (e.g. the database) is left alone
+    bool open()
+    {
+#ifndef _WIN32
+        sockaddr_un address;
+        if (_socket_path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "[ERROR] The socket path " << _socket_path << " is too long!\n";
+            return false;
+        }
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, _socket_path.c_str());
+
+        struct stat st;
+        if (::lstat(_socket_path.c_str(), &st) == 0)
+        {
+            if (!S_ISSOCK(st.st_mode))
+            {
+                std::cerr << "[ERROR] " << _socket_path << " exists and is not a socket!\n";
+                return false;
+            }
+            ::unlink(_socket_path.c_str());
+        }
+
+        _socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_socket == -1)
+            return false;
+        if (::bind(_socket, reinterpret_cast<sockaddr const *>(&address), sizeof(address)) != 0)
+        {
+            std::cerr << "[ERROR] Unable to listen on " << _socket_path << ": " << std::strerror(errno) << "\n";
+            ::close(_socket);
+            _socket = -1;
+            return false;
+        }
+        if (::listen(_socket, 64) != 0)
+        {
+            std::cerr << "[ERROR] Unable to listen on " << _socket_path << ": " << std::strerror(errno) << "\n";
+            close();
+            return false;
+        }
+        return true;
+#else
+        std::cerr << "[ERROR] slimm serve needs Unix domain sockets which are not available on this platform!\n";
+        return false;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (_socket != -1)
+        {
+            ::close(_socket);
+            ::unlink(_socket_path.c_str());
+            _socket = -1;
+        }
+#endif
+    }
+
+    // accepts connections until SHUTDOWN is requested, handler(words of a request) returns the reply
+    template <typename THandler>
+    void serve(THandler handler)
+    {
+#ifndef _WIN32
+        std::vector<connection_thread> connections;
+        while (!_stopping)
+        {
+            _join_finished(connections);
+            pollfd listening = {_socket, POLLIN, 0};
+            if (::poll(&listening, 1, SERVER_POLL_INTERVAL) <= 0)
+                continue;
+            int connection = ::accept(_socket, nullptr, nullptr);
+            if (connection == -1)
+                continue;
+            std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+            connections.push_back({std::thread([this, connection, done, &handler]()
+            {
+                _serve_connection(connection, handler);
+                *done = true;
+            }), done});
+        }
+        for (auto & connection : connections)
+            connection.worker.join();
+#else
+        (void)handler;
+#endif
+    }
+
+private:
+    std::string         _socket_path;
+    int                 _socket = -1;
+    std::atomic<bool>   _stopping{false};
+
+#ifndef _WIN32
+    struct connection_thread
+    {
+        std::thread                         worker;
+        std::shared_ptr<std::atomic<bool>>  done;
+    };
+
+    // joins the threads of closed connections so a long running server does not pile them up
+    static void _join_finished(std::vector<connection_thread> & connections)
+    {
+        auto running = std::partition(connections.begin(), connections.end(),
+                                      [](connection_thread const & c) { return !*c.done; });
+        for (auto it = running; it != connections.end(); ++it)
+            it->worker.join();
+        connections.erase(running, connections.end());
+    }
+
+    template <typename THandler>
+    void _serve_connection(int const connection, THandler & handler)
+    {
+        std::string pending;
+        char buffer[4096];
+        while (!_stopping)
+        {
+            pollfd readable = {connection, POLLIN, 0};
+            if (::poll(&readable, 1, SERVER_POLL_INTERVAL) <= 0)
+                continue;
+            ssize_t received = ::recv(connection, buffer, sizeof(buffer), 0);
+            if (received <= 0)
+                break;
+            pending.append(buffer, received);
+
+            size_t line_end;
+            while (!_stopping && (line_end = pending.find('\n')) != std::string::npos)
+            {
+                std::string line = pending.substr(0, line_end);
+                pending.erase(0, line_end + 1);
+
+                std::vector<std::string> words = split_request(line);
+                std::string reply;
+                if (words.size() == 1 && words[0] == "SHUTDOWN")
+                {
+                    _stopping = true;
+                    reply = "OK";
+                }
+                else
+                {
+                    reply = handler(words);
+                }
+                reply += "\n";
+                if (!_send(connection, reply))
+                    break;
+            }
+        }
+        ::close(connection);
+    }
+
+    inline static bool _send(int const connection, std::string const & reply)
+    {
+        size_t sent = 0;
+        while (sent < reply.size())
+        {
+            ssize_t n = ::send(connection, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+#endif
+};
+
+#endif /* PROFILE_SERVER_H */
@@ -0,0 +1,238 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef READ_CLASS_H
+#define READ_CLASS_H
+
+using namespace seqan;
+
+#include <algorithm>
+#include <cereal/types/vector.hpp>
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+// ----------------------------------------------------------------------------
+// Class bin_run
+// ----------------------------------------------------------------------------
+// count reads of a class hit bin_number of a reference
+class bin_run
+{
+public:
+    uint32_t                   bin_number;
+    uint32_t                   count;
+
+    bin_run(): bin_number(0), count(0) {}
+    bin_run(uint32_t bin, uint32_t n): bin_number(bin), count(n) {}
+
+    template <class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(bin_number, count);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class read_class
+// ----------------------------------------------------------------------------
+// Multi-mapping reads with exactly the same set of target references.
+// bins[i] holds the bins the reads hit on reference_ids[i].
+class read_class
+{
+public:
+    std::vector<uint32_t>                   reference_ids;  // sorted
+    uint32_t                                reads_count = 0;
+    std::vector<std::vector<bin_run> >      bins;
+
+    inline bool is_uniq() const
+    {
+        return reference_ids.size() == 1;
+    }
+
+    // sort the bins of every reference and merge equal ones
+    void compact()
+    {
+        for (auto & ref_bins : bins)
+        {
+            std::sort(ref_bins.begin(), ref_bins.end(),
+                      [](bin_run const & a, bin_run const & b) { return a.bin_number < b.bin_number; });
+            size_t kept = 0;
+            for (size_t i = 0; i < ref_bins.size(); ++i)
+            {
+                if (kept > 0 && ref_bins[kept - 1].bin_number == ref_bins[i].bin_number)
+                    ref_bins[kept - 1].count += ref_bins[i].count;
+                else
+                    ref_bins[kept++] = ref_bins[i];
+            }
+            ref_bins.erase(ref_bins.begin() + kept, ref_bins.end());
+            ref_bins.shrink_to_fit();
+        }
+    }
+
+    // remove references that are not in valid_ref_ids together with their bins
+    void update(std::set<uint32_t> const & valid_ref_ids)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < reference_ids.size(); ++i)
+        {
+            if (valid_ref_ids.find(reference_ids[i]) == valid_ref_ids.end()) // if not a valid ref_id
+                continue;
+            if (kept != i)
+            {
+                reference_ids[kept] = reference_ids[i];
+                bins[kept].swap(bins[i]);
+            }
+            ++kept;
+        }
+        reference_ids.erase(reference_ids.begin() + kept, reference_ids.end());
+        bins.erase(bins.begin() + kept, bins.end());
+    }
+
+    template <class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(reference_ids, reads_count, bins);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class read_classes
+// ----------------------------------------------------------------------------
+// Collapses multi-mapping reads into read_class's. Classes are looked up by a
+// fingerprint of their sorted reference ids.
+class read_classes
+{
+public:
+    typedef std::vector<read_class>::iterator        iterator;
+    typedef std::vector<read_class>::const_iterator  const_iterator;
+
+    // adds a read to the class of its targets, a new class is created if needed
+    void add(read_stat const & read)
+    {
+        _targets.clear();
+        for (size_t i = 0; i < read.targets_count(); ++i)
+            _targets.push_back(read.target(i));
+        std::sort(_targets.begin(), _targets.end(),
+                  [](target_reference const & a, target_reference const & b) { return a.reference_id < b.reference_id; });
+
+        _ref_ids.clear();
+        for (auto const & tr : _targets)
+            _ref_ids.push_back(tr.reference_id);
+
+        read_class & rc = _find_or_insert(_ref_ids);
+        ++rc.reads_count;
+        ++_reads_count;
+        for (size_t i = 0; i < _targets.size(); ++i)
+        {
+            std::vector<bin_run> & ref_bins = rc.bins[i];
+            if (!ref_bins.empty() && ref_bins.back().bin_number == _targets[i].bin_number)
+                ++ref_bins.back().count;
+            else
+                ref_bins.push_back(bin_run(_targets[i].bin_number, 1));
+        }
+    }
+
+    // moves the reads of other into these classes
+    void merge(read_classes & other)
+    {
+        for (auto & other_rc : other._classes)
+        {
+            read_class & rc = _find_or_insert(other_rc.reference_ids);
+            rc.reads_count += other_rc.reads_count;
+            for (size_t i = 0; i < other_rc.bins.size(); ++i)
+                rc.bins[i].insert(rc.bins[i].end(), other_rc.bins[i].begin(), other_rc.bins[i].end());
+        }
+        _reads_count += other._reads_count;
+        other.clear();
+    }
+
+    // merge the bins of all classes, no reads can be added afterwards
+    void compact()
+    {
+        for (auto & rc : _classes)
+            rc.compact();
+        std::unordered_multimap<uint64_t, uint32_t>().swap(_index);
+    }
+
+    inline void clear()
+    {
+        _classes.clear();
+        _index.clear();
+        _reads_count = 0;
+    }
+
+    inline read_class & operator[](size_t i)             { return _classes[i]; }
+    inline read_class const & operator[](size_t i) const { return _classes[i]; }
+    inline size_t size() const              { return _classes.size(); }
+    inline bool empty() const               { return _classes.empty(); }
+    inline uint32_t reads_count() const     { return _reads_count; }
+    inline iterator begin()                 { return _classes.begin(); }
+    inline iterator end()                   { return _classes.end(); }
+    inline const_iterator begin() const     { return _classes.begin(); }
+    inline const_iterator end() const       { return _classes.end(); }
+
+    // only compacted classes can be stored, reads can not be added after loading
+    template <class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(_classes, _reads_count);
+    }
+
+private:
+    std::vector<read_class>                         _classes;
+    std::unordered_multimap<uint64_t, uint32_t>     _index;
+    uint32_t                                        _reads_count = 0;
+    // reused between calls to add()
+    std::vector<target_reference>                   _targets;
+    std::vector<uint32_t>                           _ref_ids;
+
+    inline read_class & _find_or_insert(std::vector<uint32_t> const & ref_ids)
+    {
+        uint64_t fingerprint = fingerprint_64(reinterpret_cast<char const *>(&ref_ids[0]),
+                                              ref_ids.size() * sizeof(uint32_t), 0);
+        auto range = _index.equal_range(fingerprint);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (_classes[it->second].reference_ids == ref_ids)
+                return _classes[it->second];
+        }
+
+        _index.insert(std::make_pair(fingerprint, uint32_t(_classes.size())));
+        _classes.push_back(read_class());
+        _classes.back().reference_ids = ref_ids;
+        _classes.back().bins.resize(ref_ids.size());
+        return _classes.back();
+    }
+};
+
+#endif /* READ_CLASS_H */
@@ -37,102 +37,148 @@
 
 using namespace seqan;
 
+#include <memory>
+#include <limits>
+
+uint32_t const NO_REFERENCE = std::numeric_limits<uint32_t>::max();
+
 // ==========================================================================
 // Classes
 // ==========================================================================
 // ----------------------------------------------------------------------------
 // Class target_reference
 // ----------------------------------------------------------------------------
+// a reference a read maps to and the bin of its first hit on that reference.
+// Further hits of the same read on the same reference are not recorded.
 class target_reference
 {
 public:
     uint32_t                   reference_id;
-    std::vector<uint32_t>      positions;
+    uint32_t                   bin_number;
 
-    //constructer takes a ref id and a position for the first time
-    target_reference(uint32_t ref, uint32_t pos)
-    {
-        reference_id = ref;
-        positions.reserve(10);
-        positions.push_back(pos);
-    }
+    target_reference(uint32_t ref, uint32_t bin): reference_id(ref), bin_number(bin) {}
 };
 
 
 // ----------------------------------------------------------------------------
 // Class read_stat
 // ----------------------------------------------------------------------------
+// The first target is stored inline, only multi-mapping reads allocate
+// storage for the other targets. A read mapping to a single reference
+// takes 16 bytes and no heap allocation.
 class read_stat
 {
 public:
-    std::vector<target_reference>   targets;
-    uint32_t                        refs_length_sum = 0;
+    read_stat(): _first(NO_REFERENCE, 0) {}
+
+    read_stat(read_stat const & other): _first(other._first)
+    {
+        if (other._more)
+            _more.reset(new std::vector<target_reference>(*other._more));
+    }
+
+    read_stat(read_stat && other) = default;
+
+    read_stat & operator=(read_stat other)
+    {
+        _first = other._first;
+        std::swap(_more, other._more);
+        return *this;
+    }
+
+    inline bool empty() const
+    {
+        return _first.reference_id == NO_REFERENCE;
+    }
+
+    inline size_t targets_count() const
+    {
+        if (empty())
+            return 0;
+        return _more ? _more->size() + 1 : 1;
+    }
+
+    inline target_reference const & target(size_t i) const
+    {
+        return i == 0 ? _first : (*_more)[i - 1];
+    }
 
     //checks if all the match points are in the same sequence
-    bool is_uniq()
+    inline bool is_uniq() const
     {
-        return (targets.size() == 1);
+        return !empty() && !_more;
     }
 
     // checks if all the match points are in the same sequence
     // ignoring sequences that are not in valid_ref_ids
-    bool is_uniq(std::set<uint32_t> const & valid_ref_ids)
+    bool is_uniq(std::set<uint32_t> const & valid_ref_ids) const
     {
-        if (targets.size() == 1)
-            return true;
-        else
+        uint32_t ref_count = 0;
+        for (size_t i = 0; i < targets_count(); ++i)
         {
-            uint32_t ref_count = 0;
-            for (auto tr : targets)
-            {
-                if (valid_ref_ids.find(tr.reference_id) != valid_ref_ids.end()) // if valid ref_id
-                    ++ref_count;
-                if (ref_count > 1)
-                    return false;
-            }
+            if (valid_ref_ids.find(target(i).reference_id) != valid_ref_ids.end()) // if valid ref_id
+                ++ref_count;
+            if (ref_count > 1)
+                return false;
         }
         return true;
     }
 
-    // remove targets of masked_ref_ids
-    void update(std::set<uint32_t> const & valid_ref_ids, std::vector<reference_contig> const & references)
+    // remove targets of masked_ref_ids, in place and keeping the order
+    void update(std::set<uint32_t> const & valid_ref_ids)
     {
-        if (targets.size() == 0)
-            return;
-        else
+        size_t count = targets_count();
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i)
         {
-            std::vector<target_reference> new_targets;
-            for (auto tr : targets)
-            {
-                if (valid_ref_ids.find(tr.reference_id) != valid_ref_ids.end()) // if valid ref_id
-                    new_targets.push_back(tr);
-                else
-                    refs_length_sum -= references[tr.reference_id].length;
-            }
-            std::swap(targets, new_targets);
+            target_reference tr = target(i);
+            if (valid_ref_ids.find(tr.reference_id) == valid_ref_ids.end()) // if not a valid ref_id
+                continue;
+            if (kept == 0)
+                _first = tr;
+            else
+                (*_more)[kept - 1] = tr;
+            ++kept;
+        }
+
+        if (kept == 0)
+            _first.reference_id = NO_REFERENCE;
+        if (_more)
+        {
+            _more->erase(_more->begin() + (kept > 0 ? kept - 1 : 0), _more->end());
+            if (_more->empty())
+                _more.reset();
         }
     }
 
-    void add_target(int32_t reference_id, uint32_t bin_number)
+    void add_target(uint32_t reference_id, uint32_t bin_number)
     {
-        if (targets.empty())
+        if (empty())
         {
-            targets.push_back(target_reference(reference_id, bin_number));
+            _first = target_reference(reference_id, bin_number);
+            return;
+        }
+        if (_first.reference_id == reference_id)
             return;
+
+        if (!_more)
+        {
+            _more.reset(new std::vector<target_reference>());
         }
         else
         {
-            for (auto tar : targets)
+            for (auto const & tr : *_more)
             {
-                if(tar.reference_id == reference_id)
-                {
-                    tar.positions.push_back(bin_number);
+                if(tr.reference_id == reference_id)
                     return;
-                }
             }
-            targets.push_back(target_reference(reference_id, bin_number));
         }
+        _more->push_back(target_reference(reference_id, bin_number));
     }
+
+private:
+    target_reference                                    _first;
+    std::unique_ptr<std::vector<target_reference> >     _more;
 };
 
 #endif /* READ_STAT_H */
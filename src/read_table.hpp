@@ -0,0 +1,215 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef READ_TABLE_H
+#define READ_TABLE_H
+
+#include <limits>
+
+using namespace seqan;
+
+uint32_t const READ_TABLE_EMPTY_SLOT        = std::numeric_limits<uint32_t>::max();
+size_t const   READ_TABLE_MAX_LOAD_PERCENT  = 70;
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class read_table
+// ----------------------------------------------------------------------------
+// Flat hash table that maps reads (name + mate) to their read_stat.
+// The read_stats are stored densely in insertion order, so passes over all
+// reads are linear scans. Lookups use open addressing with linear probing
+// over two parallel arrays (fingerprints and indices into the values).
+// Growing only rehashes these slots, the read_stats never move.
+class read_table
+{
+public:
+    enum key_mode
+    {
+        names,                  // exact: fingerprint and name must match
+        fingerprints,           // only the 64-bit fingerprint is stored
+        verified_fingerprints   // like fingerprints, but counts collisions
+    };
+
+    typedef std::vector<read_stat>::iterator        iterator;
+    typedef std::vector<read_stat>::const_iterator  const_iterator;
+
+    explicit read_table(key_mode mode = names): _mode(mode) {}
+
+    // returns the read_stat of a read, a new one is added if it is not there yet
+    inline read_stat & operator()(CharString const & read_name, uint32_t const mate)
+    {
+        if (_values.size() + 1 > _max_load())
+            _rehash(std::max<size_t>(_capacity() * 2, 1024));
+
+        uint64_t fingerprint = read_fingerprint(read_name, mate);
+        size_t   mask        = _capacity() - 1;
+        for (size_t slot = fingerprint & mask; ; slot = (slot + 1) & mask)
+        {
+            uint32_t index = _slot_indices[slot];
+            if (index == READ_TABLE_EMPTY_SLOT)
+            {
+                _slot_fingerprints[slot] = fingerprint;
+                _slot_indices[slot] = _values.size();
+                _values.push_back(read_stat());
+                if (_mode != fingerprints)
+                    _names.push_back(_make_name(read_name, mate));
+                return _values.back();
+            }
+            if (_slot_fingerprints[slot] != fingerprint)
+                continue;
+            if (_mode == fingerprints)
+                return _values[index];
+            if (_has_name(index, read_name, mate))
+                return _values[index];
+            if (_mode == verified_fingerprints)
+            {
+                ++_collisions;
+                return _values[index];
+            }
+            // names mode: same fingerprint but a different read, keep probing
+        }
+    }
+
+    // size the table for the expected number of reads
+    inline void reserve(size_t reads_count)
+    {
+        size_t capacity = 1024;
+        while (capacity * READ_TABLE_MAX_LOAD_PERCENT / 100 < reads_count)
+            capacity *= 2;
+        if (capacity > _capacity())
+            _rehash(capacity);
+    }
+
+    inline void clear()
+    {
+        _values.clear();
+        _names.clear();
+        _slot_fingerprints.clear();
+        _slot_indices.clear();
+        _collisions = 0;
+    }
+
+    // like clear() but also gives the memory back
+    inline void release()
+    {
+        read_table empty_table(_mode);
+        std::swap(_values, empty_table._values);
+        std::swap(_names, empty_table._names);
+        std::swap(_slot_fingerprints, empty_table._slot_fingerprints);
+        std::swap(_slot_indices, empty_table._slot_indices);
+        _collisions = 0;
+    }
+
+    inline size_t size() const              { return _values.size(); }
+    inline bool empty() const               { return _values.empty(); }
+    inline uint32_t collisions() const      { return _collisions; }
+    inline iterator begin()                 { return _values.begin(); }
+    inline iterator end()                   { return _values.end(); }
+    inline const_iterator begin() const     { return _values.begin(); }
+    inline const_iterator end() const       { return _values.end(); }
+
+private:
+    key_mode                    _mode;
+    uint32_t                    _collisions = 0;
+    std::vector<read_stat>      _values;
+    std::vector<std::string>    _names;
+    std::vector<uint64_t>       _slot_fingerprints;
+    std::vector<uint32_t>       _slot_indices;
+
+    inline size_t _capacity() const
+    {
+        return _slot_indices.size();
+    }
+
+    inline size_t _max_load() const
+    {
+        return _capacity() * READ_TABLE_MAX_LOAD_PERCENT / 100;
+    }
+
+    inline void _rehash(size_t capacity)
+    {
+        std::vector<uint64_t> fingerprints(capacity, 0);
+        std::vector<uint32_t> indices(capacity, READ_TABLE_EMPTY_SLOT);
+        size_t mask = capacity - 1;
+        for (size_t i = 0; i < _slot_indices.size(); ++i)
+        {
+            if (_slot_indices[i] == READ_TABLE_EMPTY_SLOT)
+                continue;
+            size_t slot = _slot_fingerprints[i] & mask;
+            while (indices[slot] != READ_TABLE_EMPTY_SLOT)
+                slot = (slot + 1) & mask;
+            fingerprints[slot] = _slot_fingerprints[i];
+            indices[slot] = _slot_indices[i];
+        }
+        std::swap(_slot_fingerprints, fingerprints);
+        std::swap(_slot_indices, indices);
+    }
+
+    // the stored name is the read name followed by the mate number
+    static inline std::string _make_name(CharString const & read_name, uint32_t const mate)
+    {
+        std::string name(seqan::begin(read_name), seqan::end(read_name));
+        name.push_back('0' + mate);
+        return name;
+    }
+
+    inline bool _has_name(uint32_t const index, CharString const & read_name, uint32_t const mate) const
+    {
+        std::string const & name = _names[index];
+        size_t len = length(read_name);
+        return name.size() == len + 1 &&
+               name[len] == char('0' + mate) &&
+               std::equal(seqan::begin(read_name), seqan::end(read_name), name.begin());
+    }
+};
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function to_read_key_mode()
+// --------------------------------------------------------------------------
+inline read_table::key_mode to_read_key_mode(std::string const & read_keys)
+{
+    if (read_keys == "fingerprint")
+        return read_table::fingerprints;
+    else if (read_keys == "verify")
+        return read_table::verified_fingerprints;
+    return read_table::names;
+}
+
+#endif /* READ_TABLE_H */
@@ -35,6 +35,8 @@
 #ifndef REFERENCE_CONTIG_H
 #define REFERENCE_CONTIG_H
 
+#include <cereal/types/utility.hpp>
+#include <cereal/types/vector.hpp>
 
 using namespace seqan;
 
@@ -64,12 +66,14 @@ using namespace seqan;
 // ----------------------------------------------------------------------------
 // Class bins_coverage
 // ----------------------------------------------------------------------------
+// Nothing is allocated until the first hit. Coverages with few non-zero bins
+// are kept as a sorted list of (bin, height) pairs, they switch to a dense
+// vector of heights once more than 1/8 of the bins are non-zero.
 class bins_coverage
 {
 public:
     uint32_t                    bin_width;
     uint32_t                    number_of_bins;
-    std::vector <uint32_t>      bins_height;
 
     bins_coverage(): bin_width(0),
                      number_of_bins(0) {}
@@ -78,20 +82,108 @@ public:
     {
         bin_width = width;
         number_of_bins = totalLen/width + 1;
-        bins_height.resize(number_of_bins, 0);
     }
 
-    uint32_t none_zero_bin_count()
+    // adds count hits to a bin
+    inline void increment(uint32_t bin_number, uint32_t count = 1)
     {
-        if (_none_zero_bin_count == -1)
+        if (!_dense_bins.empty())
         {
-            _none_zero_bin_count = (number_of_bins - std::count (bins_height.begin(), bins_height.end(), 0));
+            if (_dense_bins[bin_number] == 0)
+                ++_none_zero_bin_count;
+            _dense_bins[bin_number] += count;
+            return;
         }
+
+        auto it = std::lower_bound(_sparse_bins.begin(), _sparse_bins.end(), bin_number,
+                                   [](std::pair<uint32_t, uint32_t> const & bin, uint32_t number)
+                                   {
+                                       return bin.first < number;
+                                   });
+        if (it != _sparse_bins.end() && it->first == bin_number)
+        {
+            it->second += count;
+            return;
+        }
+        _sparse_bins.insert(it, std::make_pair(bin_number, count));
+        ++_none_zero_bin_count;
+
+        if (_sparse_bins.size() > number_of_bins / 8)
+            _make_dense();
+    }
+
+    // the height of a bin
+    inline uint32_t operator[](uint32_t bin_number) const
+    {
+        if (!_dense_bins.empty())
+            return _dense_bins[bin_number];
+
+        auto it = std::lower_bound(_sparse_bins.begin(), _sparse_bins.end(), bin_number,
+                                   [](std::pair<uint32_t, uint32_t> const & bin, uint32_t number)
+                                   {
+                                       return bin.first < number;
+                                   });
+        if (it != _sparse_bins.end() && it->first == bin_number)
+            return it->second;
+        return 0;
+    }
+
+    // calls f(bin_number, height) for every non-zero bin in increasing bin order
+    template <typename TFunctor>
+    inline void for_each_none_zero_bin(TFunctor && f) const
+    {
+        if (!_dense_bins.empty())
+        {
+            for (uint32_t i = 0; i < number_of_bins; ++i)
+            {
+                if (_dense_bins[i] != 0)
+                    f(i, _dense_bins[i]);
+            }
+        }
+        else
+        {
+            for (auto const & bin : _sparse_bins)
+                f(bin.first, bin.second);
+        }
+    }
+
+    inline uint32_t none_zero_bin_count() const
+    {
         return _none_zero_bin_count;
     }
 
+    template <class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(bin_width, number_of_bins, _none_zero_bin_count, _sparse_bins, _dense_bins);
+    }
+
 private:
-    int32_t _none_zero_bin_count = -1;
+    uint32_t                                        _none_zero_bin_count = 0;
+    std::vector<std::pair<uint32_t, uint32_t> >     _sparse_bins;
+    std::vector<uint32_t>                           _dense_bins;
+
+    inline void _make_dense()
+    {
+        _dense_bins.resize(number_of_bins, 0);
+        for (auto const & bin : _sparse_bins)
+            _dense_bins[bin.first] = bin.second;
+        std::vector<std::pair<uint32_t, uint32_t> >().swap(_sparse_bins);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Class taxon_children
+// ----------------------------------------------------------------------------
+// What is needed to know about the references (children) that contributed
+// reads to a taxon.
+class taxon_children
+{
+public:
+    uint32_t            first_child     = 0;    // smallest reference id
+    uint32_t            last_child      = 0;    // largest reference id
+    uint32_t            children_count  = 0;
+    uint64_t            genome_length   = 0;    // sum of the children lengths
 };
 
 // ----------------------------------------------------------------------------
@@ -100,7 +192,6 @@ private:
 class reference_contig
 {
 public:
-    std::string         accession;
     uint32_t            taxa_id;
     uint32_t            length;
     uint32_t            reads_count;
@@ -113,8 +204,7 @@ public:
     float               uniq_abundance;
     float               uniq_abundance2;
 
-    reference_contig(): accession(""),
-                        taxa_id(0),
+    reference_contig(): taxa_id(0),
                         length(0),
                         reads_count(0),
                         uniq_reads_count(0),
@@ -126,8 +216,7 @@ public:
                         uniq_abundance(0.0),
                         uniq_abundance2(0.0){}
 
-    reference_contig(std::string & ref_name, uint32_t & t_id, uint32_t & ref_length, uint32_t & bin_width):
-                        accession(ref_name),
+    reference_contig(uint32_t t_id, uint32_t ref_length, uint32_t bin_width):
                         taxa_id(t_id),
                         length(ref_length),
                         reads_count(0),
@@ -138,6 +227,7 @@ public:
                         uniq_abundance2(0.0) 
                         {
                             // Intialize coverages based on the length of a refSeq
+                            // bins are only allocated once they are hit
                             bins_coverage tmp_cov(ref_length, bin_width);
                             cov = tmp_cov;
                             uniq_cov = tmp_cov;
@@ -177,6 +267,13 @@ public:
         return _uniq_cov_depth2;
     }
 
+    // the abundances are not stored, they are computed from the counts
+    template <class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(taxa_id, length, reads_count, uniq_reads_count, uniq_reads_count2, cov, uniq_cov, uniq_cov2);
+    }
+
 private:
     float _cov_percent = -1;
     float _uniq_cov_percent = -1;
@@ -188,22 +285,18 @@ private:
     // --------------------------------------------------------------------------
     // Function getCovDepth()
     // --------------------------------------------------------------------------
-    inline float _get_cov_depth(bins_coverage & c)
+    inline float _get_cov_depth(bins_coverage const & c)
     {
         if(c.none_zero_bin_count() == 0)
             return 0.0;
 
-        std::vector <uint32_t>::iterator it;
-
-        //copy the coverage height.
-        std::vector <float>  bHeights;
-
-        bHeights.reserve(c.number_of_bins);
-        for (unsigned int i=0; i<c.number_of_bins; ++i )
+        // mean of the heights, zero bins do not change the sum
+        float heights_sum = 0.0;
+        c.for_each_none_zero_bin([&heights_sum](uint32_t, uint32_t height)
         {
-            bHeights.push_back(float(c.bins_height[i]));
-        }
-        return mean(bHeights);
+            heights_sum += float(height);
+        });
+        return heights_sum/c.number_of_bins;
     }
 };
 #endif /* REFERENCE_CONTIG_H */
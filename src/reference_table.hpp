@@ -0,0 +1,247 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef REFERENCE_TABLE_H
+#define REFERENCE_TABLE_H
+
+#include <memory>
+#include <mutex>
+#include <iomanip>
+
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+#include <cereal/archives/binary.hpp>
+
+using namespace seqan;
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class reference_table
+// ----------------------------------------------------------------------------
+// The references of a SAM/BAM header resolved against the database. Files
+// mapped against the same index share one table.
+class reference_table
+{
+public:
+    uint64_t                    digest          = 0;
+    uint64_t                    database_stamp  = 0;
+    std::vector<std::string>    accessions;
+    std::vector<uint32_t>       taxa_ids;
+    std::vector<uint32_t>       lengths;
+    // LINAGE_LENGTH taxa ids per reference (strain .. superkingdom)
+    std::vector<uint32_t>       lineages;
+
+    inline size_t size() const
+    {
+        return accessions.size();
+    }
+
+    inline uint32_t const * lineage(uint32_t const ref_id) const
+    {
+        return &lineages[ref_id * LINAGE_LENGTH];
+    }
+
+    template <class Archive>
+    void serialize(Archive & ar)
+    {
+        ar(digest, database_stamp, accessions, taxa_ids, lengths, lineages);
+    }
+};
+
+// ==========================================================================
+// Functions
+// ==========================================================================
+
+// --------------------------------------------------------------------------
+// Function get_reference_digest()
+// --------------------------------------------------------------------------
+// a digest of the contig names and lengths of a SAM/BAM header
+template <typename TNames, typename TLengths>
+inline uint64_t get_reference_digest(TNames const & contig_names, TLengths const & contig_lengths)
+{
+    uint64_t digest = length(contig_names);
+    for (uint32_t i = 0; i < length(contig_names); ++i)
+    {
+        uint32_t contig_length = contig_lengths[i];
+        digest = fingerprint_64(reinterpret_cast<char const *>(&contig_length), sizeof(contig_length), digest);
+        if (length(contig_names[i]) > 0)
+            digest = fingerprint_64(&contig_names[i][0], length(contig_names[i]), digest);
+    }
+    return digest;
+}
+
+// --------------------------------------------------------------------------
+// Function build_reference_table()
+// --------------------------------------------------------------------------
+template <typename TNames, typename TLengths>
+inline std::shared_ptr<reference_table> build_reference_table(TNames const & contig_names,
+                                                              TLengths const & contig_lengths,
+                                                              slimm_database const & db)
+{
+    std::shared_ptr<reference_table> table = std::make_shared<reference_table>();
+    uint32_t references_count = length(contig_names);
+    table->digest = get_reference_digest(contig_names, contig_lengths);
+    table->accessions.resize(references_count);
+    table->taxa_ids.resize(references_count, 0);
+    table->lengths.resize(references_count, 0);
+    table->lineages.resize(references_count * LINAGE_LENGTH, 0);
+
+    for (uint32_t i=0; i < references_count; ++i)
+    {
+        if (length(contig_names[i]) > 0)
+        {
+            char const * name = &contig_names[i][0];
+            table->accessions[i].assign(name, accession_length(name, length(contig_names[i])));
+        }
+        table->lengths[i] = contig_lengths[i];
+
+        uint32_t const * lineage = db.find_lineage(table->accessions[i]);
+        if(lineage != nullptr)
+        {
+            table->taxa_ids[i] = lineage[0];
+            std::copy(lineage, lineage + LINAGE_LENGTH, table->lineages.begin() + i * LINAGE_LENGTH);
+        }
+    }
+    return table;
+}
+
+// --------------------------------------------------------------------------
+// Function load_reference_table()
+// --------------------------------------------------------------------------
+// returns nullptr if there is no valid table at table_path
+inline std::shared_ptr<reference_table> load_reference_table(std::string const & table_path,
+                                                             uint64_t const digest,
+                                                             uint64_t const database_stamp)
+{
+    std::ifstream is(table_path, std::ios::binary);
+    if (!is.is_open())
+        return nullptr;
+
+    std::shared_ptr<reference_table> table = std::make_shared<reference_table>();
+    try
+    {
+        cereal::BinaryInputArchive in_archive(is);
+        in_archive(*table);
+    }
+    catch (std::exception const &)
+    {
+        return nullptr;
+    }
+
+    if (table->digest != digest || table->database_stamp != database_stamp)
+        return nullptr;
+    return table;
+}
+
+// --------------------------------------------------------------------------
+// Function save_reference_table()
+// --------------------------------------------------------------------------
+inline bool save_reference_table(reference_table const & table, std::string const & table_path)
+{
+    std::ofstream os(table_path, std::ios::binary);
+    if (!os.is_open())
+        return false;
+    cereal::BinaryOutputArchive out_archive(os);
+    out_archive(table);
+    return true;
+}
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class reference_table_cache
+// ----------------------------------------------------------------------------
+// Keeps the reference tables of one database in memory, keyed by the digest
+// of the header. With sidecar files enabled a table is also stored next to
+// the database (DB.sldb.<digest>.refs) and reused by later runs as long as
+// the database file is not changed.
+class reference_table_cache
+{
+public:
+    reference_table_cache(std::string const & database_path, bool use_sidecar_files):
+                        _database_path(database_path),
+                        _database_stamp(get_file_stamp(database_path)),
+                        _use_sidecar_files(use_sidecar_files) {}
+
+    template <typename TNames, typename TLengths>
+    std::shared_ptr<reference_table const> get(TNames const & contig_names,
+                                               TLengths const & contig_lengths,
+                                               slimm_database const & db)
+    {
+        uint64_t digest = get_reference_digest(contig_names, contig_lengths);
+
+        // tables are built under the lock, files waiting for the same table
+        // would have to build it anyway
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto table_pos = _tables.find(digest);
+        if (table_pos != _tables.end())
+            return table_pos->second;
+
+        std::shared_ptr<reference_table> table;
+        std::string table_path = _sidecar_path(digest);
+        if (_use_sidecar_files)
+            table = load_reference_table(table_path, digest, _database_stamp);
+
+        if (!table)
+        {
+            table = build_reference_table(contig_names, contig_lengths, db);
+            table->database_stamp = _database_stamp;
+            if (_use_sidecar_files && !save_reference_table(*table, table_path))
+                std::cerr << "[WARNING] Unable to write reference table cache " << table_path << "!\n";
+        }
+
+        _tables[digest] = table;
+        return table;
+    }
+
+private:
+    std::string                                                             _database_path;
+    uint64_t                                                                _database_stamp;
+    bool                                                                    _use_sidecar_files;
+    std::unordered_map<uint64_t, std::shared_ptr<reference_table const> >   _tables;
+    std::mutex                                                              _mutex;
+
+    inline std::string _sidecar_path(uint64_t const digest) const
+    {
+        std::stringstream ss;
+        ss << _database_path << "." << std::hex << std::setw(16) << std::setfill('0') << digest << ".refs";
+        return ss.str();
+    }
+};
+
+#endif /* REFERENCE_TABLE_H */
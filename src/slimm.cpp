@@ -47,32 +47,26 @@
 #include "timer.hpp"
 #include "misc.hpp"
 #include "file_helper.hpp"
+#include "bgzf_reader.hpp"
+#include "profile_scheduler.hpp"
+#include "profile_server.hpp"
 #include "reference_contig.hpp"
 #include "read_stat.hpp"
+#include "read_table.hpp"
+#include "read_class.hpp"
+#include "reference_table.hpp"
+#include "profile_matrix.hpp"
 
 #include "slimm.hpp"
 
 using namespace seqan;
 
 // ----------------------------------------------------------------------------
-// Function setupArgumentParser()
+// Function add_profile_options()
 // ----------------------------------------------------------------------------
-void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
+// the options shared by slimm and slimm serve
+void add_profile_options(ArgumentParser & parser, arg_options const & options)
 {
-    // Setup ArgumentParser.
-    setAppName(parser, "slimm");
-    setShortDescription(parser, "Species Level Identification of Microbes from Metagenomes");
-    setCategory(parser, "Metagenomics");
-
-    setDateAndVersion(parser);
-    setDescription(parser);
-    // Define usage line and long description.
-    addUsageLine(parser, "[\\fIOPTIONS\\fP] \"\\fIDB\\fP\" \"\\fIIN\\fP\"");
-
-    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "DB"));
-    setValidValues(parser, 0, ".sldb");
-    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_PREFIX, "IN"));
-
     // The output file argument.
     addOption(parser, ArgParseOption("o", "output-prefix", "output path prefix.", ArgParseArgument::OUTPUT_PREFIX));
 
@@ -102,8 +96,72 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
     setDefaultValue(parser, "abundance-cut-off", options.abundance_cut_off);
 
 
+    addOption(parser, ArgParseOption("t", "threads", "Number of threads used to decompress BAM files and to process the reads.",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "threads", "1");
+    setDefaultValue(parser, "threads", options.threads);
+
+    addOption(parser, ArgParseOption("j", "jobs", "Number of SAM/BAM files to profile at the same time (with -d or slimm serve).",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "jobs", "1");
+    setDefaultValue(parser, "jobs", options.jobs);
+
+    addOption(parser, ArgParseOption("sf", "sample-fraction", "Profile only this fraction of the reads. Reads are chosen "
+                                     "by a hash of their names, i.e. the same reads are chosen in every run and the "
+                                     "sample is unbiased even for files sorted by coordinate.",
+                                     ArgParseArgument::DOUBLE, "DOUBLE"));
+    setMinValue(parser, "sample-fraction", "0.000001");
+    setMaxValue(parser, "sample-fraction", "1.0");
+    setDefaultValue(parser, "sample-fraction", options.sample_fraction);
+
+    addOption(parser, ArgParseOption("st", "stop-tolerance", "Stop reading once the length normalized abundances of "
+                                     "the references change by less than this (L1 distance) between two checks "
+                                     "(0 = read everything). Not meant for files sorted by coordinate.",
+                                     ArgParseArgument::DOUBLE, "DOUBLE"));
+    setMinValue(parser, "stop-tolerance", "0.0");
+    setDefaultValue(parser, "stop-tolerance", options.stop_tolerance);
+
+    addOption(parser, ArgParseOption("si", "stop-interval", "Number of mapped records between two checks of --stop-tolerance.",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "stop-interval", "1");
+    setDefaultValue(parser, "stop-interval", options.stop_interval);
+
+    addOption(parser, ArgParseOption("ir", "interim-records", "Write an interim profile every INT records while the "
+                                     "file is read (0 = never). It is computed in the background and replaced by "
+                                     "later ones and by the final profile.",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setDefaultValue(parser, "interim-records", options.interim_records);
+
+    addOption(parser, ArgParseOption("is", "interim-seconds", "Write an interim profile every INT seconds while the "
+                                     "file is read (0 = never).",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setDefaultValue(parser, "interim-seconds", options.interim_seconds);
+
+    addOption(parser, ArgParseOption("mm", "max-memory", "Memory budget in MiB used to decide how many files are "
+                                     "profiled at the same time (0 = 80% of the installed memory).",
+                                     ArgParseArgument::INTEGER, "INT"));
+    setDefaultValue(parser, "max-memory", options.max_memory);
     addOption(parser,
-              ArgParseOption("d", "directory", "Input is a directory."));
+              ArgParseOption("g", "name-grouped", "Records of the same read are next to each other (e.g. samtools sort -n). "
+                             "Reads are then processed as soon as they are complete, using much less memory. "
+                             "Detected automatically from SO:queryname or GO:query in the header."));
+    addOption(parser, ArgParseOption("rk", "read-keys", "How reads are told apart. \\fIname\\fP keeps the read names, "
+                                     "\\fIfingerprint\\fP keeps only a 64-bit hash of the name and mate (less memory, "
+                                     "two reads collide with a probability of about n^2/2^65 for n reads) and "
+                                     "\\fIverify\\fP uses fingerprints but also counts collisions.",
+                                     ArgParseOption::STRING));
+    setValidValues(parser, "read-keys", options.readKeysList);
+    setDefaultValue(parser, "read-keys", options.read_keys);
+
+    addOption(parser,
+              ArgParseOption("rc", "reference-cache", "Keep the accessions and taxa of the references in the SAM/BAM "
+                             "header next to the database (DB.sldb.<digest>.refs) and reuse them in later runs."));
+
+    addOption(parser,
+              ArgParseOption("ss", "save-state", "Also save the state after reading a SAM/BAM file next to its "
+                             "profile (OUTPUT_PREFIX.slst). Given as IN instead of the SAM/BAM file, the state is "
+                             "profiled again (e.g. with other cut-offs or another rank) without reading the file."));
+
     addOption(parser,
               ArgParseOption("ro", "raw-output", "Output raw reference statstics"));
 
@@ -112,6 +170,36 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
 
     addOption(parser,
               ArgParseOption("v", "verbose", "Enable verbose output."));
+}
+
+// ----------------------------------------------------------------------------
+// Function setupArgumentParser()
+// ----------------------------------------------------------------------------
+void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
+{
+    // Setup ArgumentParser.
+    setAppName(parser, "slimm");
+    setShortDescription(parser, "Species Level Identification of Microbes from Metagenomes");
+    setCategory(parser, "Metagenomics");
+
+    setDateAndVersion(parser);
+    setDescription(parser);
+    // Define usage line and long description.
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \"\\fIDB\\fP\" \"\\fIIN\\fP\"");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "DB"));
+    setValidValues(parser, 0, ".sldb");
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_PREFIX, "IN"));
+
+    add_profile_options(parser, options);
+
+    addOption(parser,
+              ArgParseOption("d", "directory", "Input is a directory."));
+
+    addOption(parser,
+              ArgParseOption("mp", "merged-profile", "With -d, also write the profiles of all files as one sample x "
+                             "taxon matrix of abundances ([OUTPUT_PREFIX_]merged_matrix.tsv) and as a binary matrix with "
+                             "the read counts ([OUTPUT_PREFIX_]merged_matrix.slmx)."));
 
     // Add Examples Section.
     addTextSection(parser, "Examples");
@@ -128,26 +216,48 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
                 "get taxonomic profiles from individual SAM/BAM files "
                 "located under \"\\fIexample-dir/\\fP\" and write them to tsv files "
                 "under \"\\fIslimm_reports/\\fP\" directory with their corsponding file names.");
+
+    addListItem(parser,
+                "\\fBslimm\\fP \\fB-d\\fP \\fB-j\\fP \\fI8\\fP \\fB-o\\fP "
+                "\\fIslimm_reports/\\fP \\fIslimm_db_5K.sldb\\fP \\fIexample-dir/\\fP",
+                "same as above but profiles up to 8 files at the same time.");
 }
 
 // --------------------------------------------------------------------------
-// Function parseCommandLine()
+// Function get_profile_options()
 // --------------------------------------------------------------------------
-ArgumentParser::ParseResult
-parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char const ** argv)
+void get_profile_options(ArgumentParser & parser, arg_options & options)
 {
-    ArgumentParser::ParseResult res = parse(parser, argc, argv);
-
-    if (res != ArgumentParser::PARSE_OK)
-        return res;
-
-    // Extract option values.
     if (isSet(parser, "bin-width"))
         getOptionValue(options.bin_width, parser, "bin-width");
 
     if (isSet(parser, "min-reads"))
         getOptionValue(options.min_reads, parser, "min-reads");
 
+    if (isSet(parser, "threads"))
+        getOptionValue(options.threads, parser, "threads");
+
+    if (isSet(parser, "jobs"))
+        getOptionValue(options.jobs, parser, "jobs");
+
+    if (isSet(parser, "max-memory"))
+        getOptionValue(options.max_memory, parser, "max-memory");
+
+    if (isSet(parser, "sample-fraction"))
+        getOptionValue(options.sample_fraction, parser, "sample-fraction");
+
+    if (isSet(parser, "stop-tolerance"))
+        getOptionValue(options.stop_tolerance, parser, "stop-tolerance");
+
+    if (isSet(parser, "stop-interval"))
+        getOptionValue(options.stop_interval, parser, "stop-interval");
+
+    if (isSet(parser, "interim-records"))
+        getOptionValue(options.interim_records, parser, "interim-records");
+
+    if (isSet(parser, "interim-seconds"))
+        getOptionValue(options.interim_seconds, parser, "interim-seconds");
+
     if (isSet(parser, "rank"))
         getOptionValue(options.rank, parser, "rank");
 
@@ -160,8 +270,17 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
     if (isSet(parser, "verbose"))
         getOptionValue(options.verbose, parser, "verbose");
 
-    if (isSet(parser, "directory"))
-        options.is_directory = true;
+    if (isSet(parser, "read-keys"))
+        getOptionValue(options.read_keys, parser, "read-keys");
+
+    if (isSet(parser, "name-grouped"))
+        options.name_grouped = true;
+
+    if (isSet(parser, "reference-cache"))
+        options.reference_cache = true;
+
+    if (isSet(parser, "save-state"))
+        options.save_state = true;
 
     if (isSet(parser, "raw-output"))
         options.raw_output = true;
@@ -169,16 +288,96 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
     if (isSet(parser, "coverage-output"))
         options.coverage_output = true;
 
+    getOptionValue(options.output_prefix, parser, "output-prefix");
+}
+
+// --------------------------------------------------------------------------
+// Function parseCommandLine()
+// --------------------------------------------------------------------------
+ArgumentParser::ParseResult
+parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char const ** argv)
+{
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+
+    if (res != ArgumentParser::PARSE_OK)
+        return res;
+
+    get_profile_options(parser, options);
+
+    if (isSet(parser, "directory"))
+        options.is_directory = true;
+
+    if (isSet(parser, "merged-profile"))
+        options.merged_profile = true;
+
     getArgumentValue(options.database_path, parser, 0);
     getArgumentValue(options.input_path, parser, 1);
 
-    getOptionValue(options.output_prefix, parser, "output-prefix");
+    // a state file writes where the SAM/BAM file it was saved from wrote
     if (!isSet(parser, "output-prefix"))
         options.output_prefix = options.input_path;
+    if (!isSet(parser, "output-prefix") && is_state_file(options.input_path))
+        options.output_prefix.resize(options.output_prefix.size() - STATE_FILE_EXTENSION.size());
 
     return ArgumentParser::PARSE_OK;
 }
 
+// --------------------------------------------------------------------------
+// Function setup_serve_argument_parser()
+// --------------------------------------------------------------------------
+void setup_serve_argument_parser(ArgumentParser & parser, arg_options const & options)
+{
+    setAppName(parser, "slimm serve");
+    setShortDescription(parser, "Species Level Identification of Microbes from Metagenomes as a service");
+    setCategory(parser, "Metagenomics");
+
+    setDateAndVersion(parser);
+    addDescription(parser, "Loads the database once and profiles the SAM/BAM files requested on a local socket. "
+                           "Every request is a line \\fBPROFILE\\fP \\fISAM/BAM\\fP [\\fIOUTPUT_PREFIX\\fP] "
+                           "[\\fIOPTION\\fP=\\fIVALUE\\fP ...] with the long names of the options below, "
+                           "e.g. rank=genus. It is answered with \\fBOK\\fP \\fIRECORDS\\fP \\fIMSECS\\fP "
+                           "once the profile is written or \\fBERROR\\fP \\fIMESSAGE\\fP. "
+                           "The options given here are the defaults of all requests. "
+                           "\\fBSHUTDOWN\\fP stops the server after the running requests.");
+    addUsageLine(parser, "[\\fIOPTIONS\\fP] \"\\fIDB\\fP\" \"\\fISOCKET\\fP\"");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "DB"));
+    setValidValues(parser, 0, ".sldb");
+    addArgument(parser, ArgParseArgument(ArgParseArgument::STRING, "SOCKET"));
+
+    add_profile_options(parser, options);
+
+    addTextSection(parser, "Examples");
+    addListItem(parser,
+                "\\fBslimm serve\\fP \\fB-j\\fP \\fI4\\fP \\fIslimm_db_5K.sldb\\fP \\fI/tmp/slimm.sock\\fP",
+                "serve profiles of up to 4 files at the same time.");
+    addListItem(parser,
+                "\\fBecho\\fP \"PROFILE example.bam slimm_reports/ rank=genus\" | \\fBnc -U\\fP \\fI/tmp/slimm.sock\\fP",
+                "profile \"\\fIexample.bam\\fP\" at genus level and write it under \"\\fIslimm_reports/\\fP\".");
+}
+
+// --------------------------------------------------------------------------
+// Function serve_main()
+// --------------------------------------------------------------------------
+// slimm serve
+int serve_main(int argc, char const ** argv)
+{
+    ArgumentParser parser;
+    arg_options options;
+    setup_serve_argument_parser(parser, options);
+
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+    if (res != ArgumentParser::PARSE_OK)
+        return res == ArgumentParser::PARSE_ERROR;
+
+    get_profile_options(parser, options);
+    std::string socket_path;
+    getArgumentValue(options.database_path, parser, 0);
+    getArgumentValue(socket_path, parser, 1);
+
+    return serve_taxonomic_profiles(options, socket_path);
+}
+
 // --------------------------------------------------------------------------
 // Function main()
 // --------------------------------------------------------------------------
@@ -186,6 +385,9 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
 // Program entry point.
 int main(int argc, char const ** argv)
 {
+    if (argc > 1 && std::string(argv[1]) == "serve")
+        return serve_main(argc - 1, argv + 1);
+
     // Parse the command line.
     ArgumentParser parser;
     arg_options options;
@@ -59,45 +59,111 @@ struct arg_options
                       "phylum",
                       "superkingdom"};
 
+    TList readKeysList = {"name",
+                          "fingerprint",
+                          "verify"};
+
     float               cov_cut_off;
     float               abundance_cut_off;
+    float               sample_fraction;
+    float               stop_tolerance;
+    uint32_t            stop_interval;
     uint32_t            bin_width;
     uint32_t            min_reads;
+    uint32_t            threads;
+    uint32_t            jobs;
+    uint32_t            max_memory;
+    uint32_t            interim_records;
+    uint32_t            interim_seconds;
     bool                verbose;
     bool                is_directory;
+    bool                name_grouped;
+    bool                reference_cache;
+    bool                merged_profile;
+    bool                save_state;
     bool                raw_output;
     bool                coverage_output;
     std::string         rank;
+    std::string         read_keys;
     std::string         input_path;
     std::string         output_prefix;
     std::string         database_path;
 
     arg_options() : cov_cut_off(0.95),
                     abundance_cut_off(0.01),
+                    sample_fraction(1.0),
+                    stop_tolerance(0.0),
+                    stop_interval(1000000),
                     bin_width(0),
                     min_reads(0),
+                    threads(1),
+                    jobs(1),
+                    max_memory(0),
+                    interim_records(0),
+                    interim_seconds(0),
                     verbose(false),
                     is_directory(false),
+                    name_grouped(false),
+                    reference_cache(false),
+                    merged_profile(false),
+                    save_state(false),
                     raw_output(false),
                     coverage_output(false),
                     rank("species"),
+                    read_keys("name"),
                     input_path(""),
                     output_prefix(""),
                     database_path("") {}
 };
 
+// ----------------------------------------------------------------------------
+// Class reference_hit
+// ----------------------------------------------------------------------------
+// a hit of a read on a bin of a reference, collected by one thread and added
+// to the reference by the thread that owns it (see slimm::account_reads)
+class reference_hit
+{
+public:
+    uint32_t                   reference_id;
+    uint32_t                   bin_number;
+    bool                       uniq;
+
+    reference_hit(uint32_t ref, uint32_t bin, bool u): reference_id(ref), bin_number(bin), uniq(u) {}
+};
+
+// number of reads accounted between two merges of the threads' hits
+uint32_t const ACCOUNT_BLOCK_SIZE = 1 << 20;
+
+// version of the state files written by --save-state
+uint32_t const STATE_FILE_VERSION = 1;
+
+// seed of the read name hash used by --sample-fraction
+uint64_t const SAMPLE_SEED = 0x5ab5ab5ab5ab5ab5ULL;
+
 // ----------------------------------------------------------------------------
 // Class slimm
 // ----------------------------------------------------------------------------
 class slimm
 {
 public:
-    //constructor with argument options
-    slimm(arg_options op): options(op)
+    //constructor with argument options, a shared database, the shared
+    //reference tables and the file to profile
+    slimm(arg_options const & op,
+          slimm_database const & database,
+          reference_table_cache & reference_tables,
+          std::string const & bam_file_path):
+                        options(op),
+                        db(database),
+                        ref_tables(reference_tables),
+                        reads(to_read_key_mode(op.read_keys)),
+                        _bam_file_path(bam_file_path)
     {
-        collect_bam_files();
         get_considered_ranks();
-        load_slimm_database(db, options.database_path);
+    }
+
+    ~slimm()
+    {
+        wait_for_interim_profile();
     }
 
     arg_options                                         options;
@@ -116,38 +182,91 @@ public:
     uint32_t                    matches_count             = 0;
     uint32_t                    uniq_matches_count        = 0;
     uint32_t                    uniq_matches_count2       = 0;
+    uint32_t                    fingerprint_collisions    = 0;
+    uint64_t                    records_count             = 0;
+    bool                        name_grouped              = false;
+    bool                        stopped_early             = false;
 
 
-    slimm_database                                      db;
+    slimm_database const &                              db;
+    reference_table_cache &                             ref_tables;
+    // accessions and taxa of the references in the SAM/BAM header
+    std::shared_ptr<reference_table const>              reference_info;
     std::set<uint32_t>                                  valid_ref_ids;
     std::vector<taxa_ranks>                             considered_ranks;
     std::vector<reference_contig>                       references;
-    std::unordered_map<std::string, read_stat>          reads;
+    read_table                                          reads;
+    // multi-mapping reads collapsed by their set of references
+    read_classes                                        multi_reads;
     std::unordered_map<uint32_t, uint32_t>              taxon_id__read_count;
-    std::unordered_map<uint32_t, std::set<uint32_t> >   taxon_id__children;
+    std::unordered_map<uint32_t, taxon_children>        taxon_id__children;
+    // the lines of the taxonomic profile (see write_abundance)
+    std::vector<profile_row>                            profile;
 
     inline std::string current_bam_file_path()
     {
-        return _input_paths[current_file_index];
+        return _bam_file_path;
+    }
+
+    inline std::string const & accession(uint32_t const ref_id) const
+    {
+        return reference_info->accessions[ref_id];
+    }
+
+    // the LINAGE_LENGTH taxa ids of a reference (all 0 if it is not in the database)
+    inline uint32_t const * lineage_of(uint32_t const ref_id) const
+    {
+        return reference_info->lineage(ref_id);
+    }
+
+    // progress messages go to std::cerr unless they are buffered
+    // e.g. while several files are profiled at the same time
+    inline std::ostream & log()
+    {
+        if (_buffer_log)
+            return _log_buffer;
+        return std::cerr;
+    }
+
+    inline void buffer_log()
+    {
+        _buffer_log = true;
+    }
+
+    inline std::string buffered_log() const
+    {
+        return _log_buffer.str();
     }
 
     inline void     analyze_alignments(BamFileIn & bam_file);
+    inline void     compute_abundances();
+    inline void     account_read(read_stat const & read);
+    inline void     account_reads(read_table const & table);
+    inline void     finish_grouped_reads(read_stat (& mates)[3]);
     inline float    coverage_cut_off();
     inline float    expected_coverage() const;
     inline void     filter_alignments();
-    inline void     get_profiles();
+    inline bool     get_profiles();
+    inline bool     read_alignments(Timer<> & stop_watch);
+    inline bool     save_state(std::string const & state_path) const;
+    inline bool     load_state(std::string const & state_path);
     inline void     get_reads_lca_count();
     inline uint32_t min_reads();
     inline uint32_t min_uniq_reads();
     inline void     print_filter_stat();
     inline void     print_matches_stat();
+    inline void     print_consumption(parallel_bgzf_istream const & bgzf_stream);
     inline float    uniq_coverage_cut_off();
     inline void     write_raw_stat();
     inline void     write_coverage();
+    inline void     get_abundance_rows();
     inline void     write_abundance();
-    inline void     reset();
-    inline uint32_t get_lca(std::set<uint32_t> const & ref_ids);
-    inline std::string get_lineage_string(taxa_ranks rank, std::vector<uint32_t> const & linage);
+    inline void     start_interim_profile();
+    inline void     wait_for_interim_profile();
+    inline void     write_interim_profile();
+
+    inline uint32_t get_lca(std::vector<uint32_t> const & ref_ids) const;
+    inline std::string get_lineage_string(taxa_ranks rank, uint32_t const * linage);
     inline std::string get_lineage_string(taxa_ranks rank, uint32_t const & taxa_id);
 
 private:
@@ -156,105 +275,277 @@ private:
     float                       _uniq_coverage_cut_off  = 0.0;
     int32_t                     _min_uniq_reads         = -1;
     int32_t                     _min_reads              = -1;
-    std::vector<std::string>    _input_paths;
+    bool                        _buffer_log             = false;
+    std::string                 _bam_file_path;
+    std::ostringstream          _log_buffer;
+
+    // interim profiles (see start_interim_profile)
+    std::thread                                         _interim_thread;
+    std::atomic<bool>                                   _interim_running{false};
+    uint32_t                                            _interim_hits_count     = 0;
+    std::chrono::steady_clock::time_point               _interim_time;
+    std::shared_ptr<slimm>                              _interim_reads;
+    size_t                                              _interim_reads_count    = 0;
+
+    // --stop-tolerance: mapped records per reference and the abundances at the last check
+    std::vector<uint32_t>                               _record_hits;
+    std::vector<double>                                 _last_abundances;
+
+    // true if the length normalized abundances changed by less than the
+    // tolerance (L1 distance) since the last check
+    inline bool _has_converged()
+    {
+        std::vector<double> abundances(_record_hits.size(), 0.0);
+        double total = 0.0;
+        for (uint32_t i = 0; i < _record_hits.size(); ++i)
+        {
+            abundances[i] = double(_record_hits[i]) / std::max(references[i].length, 1u);
+            total += abundances[i];
+        }
+        double change = 0.0;
+        for (uint32_t i = 0; i < abundances.size(); ++i)
+        {
+            abundances[i] /= total;
+            if (!_last_abundances.empty())
+                change += std::abs(abundances[i] - _last_abundances[i]);
+        }
+        bool converged = !_last_abundances.empty() && change < options.stop_tolerance;
+        _last_abundances.swap(abundances);
+        return converged;
+    }
+
+    // an interim profile is due every interim_records records or interim_seconds seconds
+    inline bool _interim_due() const
+    {
+        if (options.interim_records > 0 && hits_count - _interim_hits_count >= options.interim_records)
+            return true;
+        // the clock is only looked at every 4096 records
+        return options.interim_seconds > 0 && (hits_count & 0xFFF) == 0 &&
+               std::chrono::steady_clock::now() - _interim_time >= std::chrono::seconds(options.interim_seconds);
+    }
 
     // member functions
-    inline void collect_bam_files();
+    inline bool open_bam_file(BamFileIn & bam_file, BamHeader & bam_header, parallel_bgzf_istream & bgzf_stream);
     inline void get_considered_ranks();
     inline void load_taxonomic_info();
 };
 
-inline void slimm::reset()
-{
-    avg_read_length           = 0;
-    matched_ref_length        = 0;
-    reference_count           = 0;
-    failed_by_min_read        = 0;
-    failed_by_min_uniq_read   = 0;
-    failed_byCov              = 0;
-    failed_byUniqCov          = 0;
-    hits_count                = 0;
-    uniq_hits_count           = 0;
-    matches_count             = 0;
-    uniq_matches_count        = 0;
-    uniq_matches_count2       = 0;
-
-    valid_ref_ids.clear();
-    references.clear();
-    reads.clear();
-    taxon_id__read_count.clear();
-    taxon_id__children.clear();
+// add the hits of a read to the counts and coverages of its references
+inline void slimm::account_read(read_stat const & read)
+{
+    ++matches_count;
+    if(read.is_uniq())
+    {
+        target_reference const & target = read.target(0);
+        ++uniq_matches_count;
+
+        references[target.reference_id].reads_count += 1;
+        references[target.reference_id].cov.increment(target.bin_number);
+        references[target.reference_id].uniq_reads_count += 1;
+        uniq_hits_count += 1;
+        references[target.reference_id].uniq_cov.increment(target.bin_number);
+    }
+    else
+    {
+        size_t len = read.targets_count();
+        for (size_t i=0; i < len; ++i)
+        {
+            target_reference const & target = read.target(i);
+            references[target.reference_id].reads_count += 1;
+            references[target.reference_id].cov.increment(target.bin_number);
+        }
+    }
+}
+
+// account all reads of the read table. With several threads the reads are
+// processed in blocks. Each thread collects the hits of its share of a block
+// and then adds the hits of the references it owns (reference_id % threads,
+// counting the threads the team actually got) from all threads, so the
+// results do not depend on the number of threads.
+inline void slimm::account_reads(read_table const & table)
+{
+    uint32_t threads_count = get_usable_threads(options.threads);
+    if (threads_count == 1)
+    {
+        for (auto const & read : table)
+        {
+            account_read(read);
+            if (!read.is_uniq())
+                multi_reads.add(read);
+        }
+        return;
+    }
+
+    size_t reads_count = table.size();
+    read_table::const_iterator reads_begin = table.begin();
+
+    // hits[producer][owner]
+    std::vector<std::vector<std::vector<reference_hit> > > hits(threads_count,
+                                                               std::vector<std::vector<reference_hit> >(threads_count));
+    std::vector<read_classes> local_multi_reads(threads_count);
+    std::vector<uint32_t> local_matches_count(threads_count, 0);
+    std::vector<uint32_t> local_uniq_matches_count(threads_count, 0);
+
+    #pragma omp parallel num_threads(threads_count)
+    {
+        // the team may get fewer threads than requested, the reads and
+        // references are split among the threads it actually has
+        uint32_t t = get_thread_num();
+        uint32_t team_size = get_num_threads();
+        for (size_t block_begin = 0; block_begin < reads_count; block_begin += ACCOUNT_BLOCK_SIZE)
+        {
+            size_t block_size = std::min<size_t>(ACCOUNT_BLOCK_SIZE, reads_count - block_begin);
+            size_t end = block_begin + block_size * (t + 1) / team_size;
+            for (size_t i = block_begin + block_size * t / team_size; i < end; ++i)
+            {
+                read_stat const & read = reads_begin[i];
+                bool uniq = read.is_uniq();
+                ++local_matches_count[t];
+                if (uniq)
+                    ++local_uniq_matches_count[t];
+                else
+                    local_multi_reads[t].add(read);
+
+                for (size_t j = 0; j < read.targets_count(); ++j)
+                {
+                    target_reference const & target = read.target(j);
+                    hits[t][target.reference_id % team_size].push_back(reference_hit(target.reference_id,
+                                                                                     target.bin_number,
+                                                                                     uniq));
+                }
+            }
+
+            #pragma omp barrier
+            for (uint32_t producer = 0; producer < team_size; ++producer)
+            {
+                for (auto const & hit : hits[producer][t])
+                {
+                    reference_contig & ref = references[hit.reference_id];
+                    ref.reads_count += 1;
+                    ref.cov.increment(hit.bin_number);
+                    if (hit.uniq)
+                    {
+                        ref.uniq_reads_count += 1;
+                        ref.uniq_cov.increment(hit.bin_number);
+                    }
+                }
+            }
+            #pragma omp barrier
+            for (auto & owner_hits : hits[t])
+                owner_hits.clear();
+        }
+    }
 
+    for (uint32_t t = 0; t < threads_count; ++t)
+    {
+        matches_count += local_matches_count[t];
+        uniq_matches_count += local_uniq_matches_count[t];
+        uniq_hits_count += local_uniq_matches_count[t];
+        multi_reads.merge(local_multi_reads[t]);
+    }
 }
 
+// account the reads of a finished read name right away
+// only multi-mapping reads are kept for filtering and LCA
+inline void slimm::finish_grouped_reads(read_stat (& mates)[3])
+{
+    for (auto & read : mates)
+    {
+        if (read.empty())
+            continue;
+        account_read(read);
+        if (!read.is_uniq())
+            multi_reads.add(read);
+        read = read_stat();
+    }
+}
 
 inline void slimm::analyze_alignments(BamFileIn & bam_file)
 {
     BamAlignmentRecord record;
+
+    // name grouped input: reads (unpaired, first and last mate) of the current read name
+    read_stat  mates[3];
+    CharString current_name;
+    _interim_time = std::chrono::steady_clock::now();
+
+    // reads are kept if the hash of their name is below the threshold, so
+    // all records of a read are kept or skipped together in any file order
+    uint64_t sample_threshold = std::numeric_limits<uint64_t>::max();
+    if (options.sample_fraction < 1.0)
+        sample_threshold = uint64_t(double(options.sample_fraction) * 18446744073709551616.0);
+    if (options.stop_tolerance > 0.0)
+        _record_hits.assign(length(references), 0);
+
     while (!atEnd(bam_file))
     {
         readRecord(record, bam_file);
+        ++records_count;
         if (hasFlagUnmapped(record) || record.rID == BamAlignmentRecord::INVALID_REFID)
             continue;  // Skip these records.
+        if (sample_threshold != std::numeric_limits<uint64_t>::max() &&
+            fingerprint_64(toCString(record.qName), length(record.qName), SAMPLE_SEED) > sample_threshold)
+            continue;  // Not in the sample.
 
         uint32_t center_position =  std::min(record.beginPos + (avg_read_length/2), references[record.rID].length);
         uint32_t relative_bin_no = center_position/options.bin_width;
+        uint32_t mate = hasFlagFirst(record) ? 1 : (hasFlagLast(record) ? 2 : 0);
+        ++hits_count;
+        if (_interim_due())
+            start_interim_profile();
+        if (options.stop_tolerance > 0.0)
+        {
+            ++_record_hits[record.rID];
+            if (hits_count % options.stop_interval == 0 && _has_converged())
+            {
+                stopped_early = true;
+                break;
+            }
+        }
+
+        if (name_grouped)
+        {
+            // all records of a read name are seen once the name changes
+            if (record.qName != current_name)
+            {
+                finish_grouped_reads(mates);
+                current_name = record.qName;
+            }
+            mates[mate].add_target(record.rID, relative_bin_no);
+            continue;
+        }
 
         // maintain read properties under slimm.reads
-        std::string read_name = toCString(record.qName);
-        if(hasFlagFirst(record))
-            append(read_name, ".1");
-        else if(hasFlagLast(record))
-            append(read_name, ".2");
-        
-        // if there is no read with read_name this will create one.
-        reads[read_name].add_target(record.rID, relative_bin_no);
-        ++hits_count;
+        // if there is no read with this name and mate this will create one.
+        reads(record.qName, mate).add_target(record.rID, relative_bin_no);
     }
+    finish_grouped_reads(mates);
 
+    // the final profile must not be overwritten by an interim one
+    wait_for_interim_profile();
+    _interim_reads.reset();
 
     if (hits_count == 0)
         return;
 
-    for (auto it= reads.begin(); it != reads.end(); ++it)
+    account_reads(reads);
+
+    if (options.read_keys == "verify")
     {
-        if(it->second.is_uniq())
-        {
-            uint32_t reference_id = it->second.targets[0].reference_id;
-            it->second.refs_length_sum += references[reference_id].length;
-            ++uniq_matches_count;
+        fingerprint_collisions = reads.collisions();
+        log() << "\n  " << fingerprint_collisions << " read name fingerprint collisions found.\n";
+    }
 
-            size_t pos_count = (it->second.targets[0]).positions.size();
-            references[reference_id].reads_count += pos_count;
-            it->second.refs_length_sum += references[reference_id].length;
-            for (size_t j=0; j < pos_count; ++j)
-            {
-                uint32_t bin_number = (it->second.targets[0]).positions[j];
-                ++references[reference_id].cov.bins_height[bin_number];
-            }
-            references[reference_id].uniq_reads_count += 1;
-            uniq_hits_count += 1;
-            ++references[reference_id].uniq_cov.bins_height[(it->second.targets[0]).positions[0]];
-        }
-        else
-        {
-            size_t len = it->second.targets.size();
-            for (size_t i=0; i < len; ++i)
-            {
+    // everything after this point only needs the classes of multi-mapping reads
+    reads.release();
+    multi_reads.compact();
 
-                uint32_t reference_id = it->second.targets[i].reference_id;
-                it->second.refs_length_sum += references[reference_id].length;
+    compute_abundances();
+}
 
-                // ***** all of the matches in multiple pos will be counted *****
-                references[reference_id].reads_count += (it->second.targets[i]).positions.size();
-                for (auto bin_number : (it->second.targets[i]).positions)
-                {
-                    ++references[reference_id].cov.bins_height[bin_number];
-                }
-            }
-        }
-    }
-    matches_count = reads.size();
+// the abundances of the references from their reads counts
+inline void slimm::compute_abundances()
+{
 
     float totalAb = 0.0;
     for (uint32_t i=0; i<length(references); ++i)
@@ -302,27 +593,12 @@ inline void slimm::analyze_alignments(BamFileIn & bam_file)
     }
 }
 
-//collect the sam files to process
-inline void slimm::collect_bam_files()
+// open the current file, decompressing BGZF blocks in parallel if asked to
+inline bool slimm::open_bam_file(BamFileIn & bam_file, BamHeader & bam_header, parallel_bgzf_istream & bgzf_stream)
 {
-    number_of_files = 1;
-    if (options.is_directory)
-    {
-        _input_paths = get_bam_files_in_directory(options.input_path);
-        number_of_files = length(_input_paths);
-        if (options.verbose)
-            std::cerr << number_of_files << " SAM/BAM Files found under the directory: " << options.input_path << "!\n";
-    }
-    else
-    {
-        if (is_file(toCString(options.input_path)))
-            _input_paths.push_back(options.input_path);
-        else
-        {
-            std::cerr << options.input_path << " is not a file use -d option for a directory.\n";
-            exit(1);
-        }
-    }
+    if (options.threads > 1 && is_bgzf_file(current_bam_file_path()))
+        return read_bam_file(bam_file, bam_header, bgzf_stream, current_bam_file_path());
+    return read_bam_file(bam_file, bam_header, current_bam_file_path());
 }
 
 float slimm::coverage_cut_off()
@@ -377,122 +653,235 @@ inline void slimm::filter_alignments()
         }
     }
 
-    for (auto it= reads.begin(); it != reads.end(); ++it)
+    // uniquely matching reads stay unique if their reference is valid
+    for (auto valid_id : valid_ref_ids)
+    {
+        references[valid_id].uniq_reads_count2 = references[valid_id].uniq_reads_count;
+        references[valid_id].uniq_cov2 = references[valid_id].uniq_cov;
+        uniq_matches_count2 += references[valid_id].uniq_reads_count;
+    }
+
+    // drop the invalid references of the multi-mapping reads
+    int64_t classes_count = multi_reads.size();
+    #pragma omp parallel for num_threads(get_usable_threads(options.threads)) schedule(dynamic, 1024)
+    for (int64_t i = 0; i < classes_count; ++i)
+        multi_reads[i].update(valid_ref_ids);
+
+    // multi-mapping reads become unique if only one of their references is valid
+    for (auto const & rc : multi_reads)
     {
-        it->second.update(valid_ref_ids, references);
-        if(it->second.is_uniq())
+        if(rc.is_uniq())
         {
-            uint32_t reference_id = (it->second.targets[0]).reference_id;
-            references[reference_id].uniq_reads_count2 += 1;
-            uniq_matches_count2 += 1;
-            uint32_t bin_number = (it->second.targets[0]).positions[0];
-            ++references[reference_id].uniq_cov2.bins_height[bin_number];
+            reference_contig & ref = references[rc.reference_ids[0]];
+            ref.uniq_reads_count2 += rc.reads_count;
+            uniq_matches_count2 += rc.reads_count;
+            for (auto const & run : rc.bins[0])
+                ref.uniq_cov2.increment(run.bin_number, run.count);
         }
     }
 }
 
+// Saves everything the steps after reading need (references with their
+// bins, classes of multi-mapping reads, counts, average read length and bin
+// width) so a file can be profiled again with other cut-offs or ranks.
+inline bool slimm::save_state(std::string const & state_path) const
+{
+    std::ofstream os(state_path, std::ios::binary);
+    if (!os.is_open())
+        return false;
+    cereal::BinaryOutputArchive out_archive(os);
+    out_archive(STATE_FILE_VERSION, *reference_info, avg_read_length, options.bin_width, name_grouped,
+                records_count, hits_count, uniq_hits_count, matches_count, uniq_matches_count,
+                fingerprint_collisions, references, multi_reads);
+    return os.good();
+}
+
+// the counterpart of save_state, the reads are accounted afterwards
+inline bool slimm::load_state(std::string const & state_path)
+{
+    std::ifstream is(state_path, std::ios::binary);
+    if (!is.is_open())
+        return false;
+
+    std::shared_ptr<reference_table> table = std::make_shared<reference_table>();
+    try
+    {
+        cereal::BinaryInputArchive in_archive(is);
+        uint32_t version = 0;
+        in_archive(version);
+        if (version != STATE_FILE_VERSION)
+            return false;
+        in_archive(*table, avg_read_length, options.bin_width, name_grouped,
+                   records_count, hits_count, uniq_hits_count, matches_count, uniq_matches_count,
+                   fingerprint_collisions, references, multi_reads);
+    }
+    catch (std::exception const &)
+    {
+        return false;
+    }
+    if (references.size() != table->size() ||
+        table->taxa_ids.size() != table->size() ||
+        table->lengths.size() != table->size())
+        return false;
+
+    // the taxa of the references are looked up again if the database changed
+    uint64_t database_stamp = get_file_stamp(options.database_path);
+    if (table->database_stamp != database_stamp)
+    {
+        std::shared_ptr<reference_table> resolved = build_reference_table(table->accessions, table->lengths, db);
+        resolved->digest = table->digest;
+        resolved->database_stamp = database_stamp;
+        table = resolved;
+        for (uint32_t i = 0; i < references.size(); ++i)
+            references[i].taxa_id = table->taxa_ids[i];
+    }
+    reference_info = table;
+    compute_abundances();
+    return true;
+}
+
 // get taxonomic profiles from the sam/bam 
-inline void slimm::get_profiles()
+// returns false if the file could not be read
+inline bool slimm::get_profiles()
 {
     Timer<>  stop_watch;
 
-    BamFileIn bam_file;
-    BamHeader bam_header;
-
-    std::cerr   << "\nReading " << current_file_index + 1 << " of " << number_of_files << " files ... ("
+    log()       << "\nReading " << current_file_index + 1 << " of " << number_of_files << " files ... ("
                 << get_file_name(current_bam_file_path()) << ")\n"
                 <<"=================================================================\n";
 
-    if (read_bam_file(bam_file, bam_header, current_bam_file_path()))
+    if (is_state_file(current_bam_file_path()))
     {
-        //get average read length from a sample (size = 100K)
-        avg_read_length = get_avg_read_length(bam_file, 100000);
+        log()<<"Loading the state of a profiled file ............. ";
+        if (!load_state(current_bam_file_path()))
+        {
+            log() << "\n[ERROR] " << current_bam_file_path() << " is not a valid SLIMM state file!" << std::endl;
+            return false;
+        }
+        log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
+    else
+    {
+        if (!read_alignments(stop_watch))
+            return false;
 
-        //if bin_width is not given use avg read length
-        if (options.bin_width == 0) 
-            options.bin_width = avg_read_length;
+        if (options.save_state)
+        {
+            std::string state_path = get_tsv_file_name(options.output_prefix, current_bam_file_path()) + STATE_FILE_EXTENSION;
+            log()<<"Saving the state to a file ....................... ";
+            if (!save_state(state_path))
+                log() << "\n[WARNING] Unable to write " << state_path << "! ";
+            log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+        }
+    }
 
-        //reset the bam_file to the first recored by closing and reopening
-        close(bam_file);
+    if (hits_count == 0)
+    {
+        log() << "[WARNING] No mapped reads found in BAM file!" << std::endl;
+        return true;
+    }
 
-        read_bam_file(bam_file, bam_header, current_bam_file_path());
+    // Set the minimum reads to 10k-th of the total number of matched reads if not set by the user
+    if (options.min_reads == 0)
+      options.min_reads = 1 + ((matches_count - 1) / 10000);
+    if (options.verbose)
+        print_matches_stat();
 
-        StringSet<CharString>    contig_names = contigNames(context(bam_file));
-        StringSet<uint32_t>      refLengths;
-        refLengths = contigLengths(context(bam_file));
+    log()   << "Filtering unlikely sequences ..................... ";
+    filter_alignments();
+    log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
 
-        uint32_t references_count = length(contig_names);
-        references.resize(references_count);
+    if (options.verbose)
+        print_filter_stat();
 
-        std::cerr<<"Intializing coverages for all reference genome ... ";
-        // Intialize coverages for all genomes
+    if (options.raw_output)
+    {
+        log()<<"Writing features to a file ....................... ";
+        write_raw_stat();
+        log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
 
-        for (uint32_t i=0; i < references_count; ++i)
-        {
-            std::string accession = get_accession_id(contig_names[i]);
-            uint32_t taxa_id = 0;
-            auto ac_pos = db.ac__taxid.find(accession);
-            if(ac_pos != db.ac__taxid.end())
-            {
-                taxa_id = ac_pos->second[0];
-            }
-            else
-            {
-                db.ac__taxid[accession] = std::vector<uint32_t>(LINAGE_LENGTH, 0);
-            }
-            reference_contig current_ref(accession, taxa_id, refLengths[i], options.bin_width);
-            references[i] = current_ref;
-        }
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    if (options.coverage_output)
+    {
+        log()<<"Writing coverage profiles to a file ....................... ";
+        write_coverage();
+        log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    }
 
-        std::cerr<<"Analysing alignments, reads and references ....... ";
-        analyze_alignments(bam_file);
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
-        if (hits_count == 0)
-        {
-            std::cerr << "[WARNING] No mapped reads found in BAM file!" << std::endl;
-            return;
-        }
+    log()<<"Assigning reads to Least Common Ancestor (LCA) ... ";
+    get_reads_lca_count();
+    log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
 
-        // Set the minimum reads to 10k-th of the total number of matched reads if not set by the user
-        if (options.min_reads == 0)
-          options.min_reads = 1 + ((matches_count - 1) / 10000);
-        if (options.verbose)
-            print_matches_stat();
+    log()<<"Writing taxnomic profile(s) ...................... ";
+    write_abundance();
+    if (options.verbose)
+        log()<<"\n.................................................. ";
+    log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
 
-        std::cerr   << "Filtering unlikely sequences ..................... ";
-        filter_alignments();
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    log()<<"[Done!] File took " << stop_watch.elapsed() <<" secs to process.\n";
+    return true;
+}
 
-        if (options.verbose)
-            print_filter_stat();
+// reads the SAM/BAM file up to the point where all reads are accounted,
+// returns false if the file could not be read
+inline bool slimm::read_alignments(Timer<> & stop_watch)
+{
+    BamFileIn bam_file;
+    BamHeader bam_header;
+    parallel_bgzf_istream bgzf_stream(options.threads);
 
-        if (options.raw_output)
-        {
-            std::cerr<<"Writing features to a file ....................... ";
-            write_raw_stat();
-            std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
-        }
+    if (!open_bam_file(bam_file, bam_header, bgzf_stream))
+        return false;
 
-        if (options.coverage_output)
-        {
-            std::cerr<<"Writing coverage profiles to a file ....................... ";
-            write_coverage();
-            std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
-        }
+    //get average read length from a sample (size = 100K)
+    avg_read_length = get_avg_read_length(bam_file, 100000);
 
-        std::cerr<<"Assigning reads to Least Common Ancestor (LCA) ... ";
-        get_reads_lca_count();
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    //if bin_width is not given use avg read length
+    if (options.bin_width == 0) 
+        options.bin_width = avg_read_length;
 
-        std::cerr<<"Writing taxnomic profile(s) ...................... ";
-        write_abundance();
-        if (options.verbose)
-            std::cerr<<"\n.................................................. ";
-        std::cerr<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    //reset the bam_file to the first recored by closing and reopening
+    close(bam_file);
+
+    open_bam_file(bam_file, bam_header, bgzf_stream);
 
-        std::cerr<<"[Done!] File took " << stop_watch.elapsed() <<" secs to process.\n";
+    // name grouped input is profiled one read name at a time
+    name_grouped = options.name_grouped || is_query_grouped(bam_header);
+    if (options.verbose && name_grouped)
+        log() << "Input is grouped by read name, reads are processed as they are completed.\n";
+    if (options.stop_tolerance > 0.0 && is_coordinate_sorted(bam_header))
+        log() << "[WARNING] Records are sorted by coordinate, the first references would dominate the "
+                 "stopping rule. Use an unsorted or name sorted file with --stop-tolerance.\n";
+
+    // size the read table for the expected number of reads, with --sample-fraction
+    // only for the sampled ones (plus a margin, the table grows if needed)
+    if (!name_grouped)
+    {
+        uint64_t expected_reads = estimate_records_count(current_bam_file_path(), avg_read_length);
+        if (options.sample_fraction < 1.0)
+            expected_reads = uint64_t(expected_reads * std::min(1.0, options.sample_fraction * 1.1));
+        reads.reserve(expected_reads);
     }
+
+    log()<<"Intializing coverages for all reference genome ... ";
+    // files mapped against the same index share the accession/taxa lookup
+    reference_info = ref_tables.get(contigNames(context(bam_file)), contigLengths(context(bam_file)), db);
+
+    uint32_t references_count = reference_info->size();
+    references.clear();
+    references.reserve(references_count);
+
+    // Intialize coverages for all genomes
+    for (uint32_t i=0; i < references_count; ++i)
+        references.emplace_back(reference_info->taxa_ids[i], reference_info->lengths[i], options.bin_width);
+    log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+
+    log()<<"Analysing alignments, reads and references ....... ";
+    analyze_alignments(bam_file);
+    log()<<"[" << stop_watch.lap() <<" secs]"  << std::endl;
+    if (options.sample_fraction < 1.0 || options.stop_tolerance > 0.0)
+        print_consumption(bgzf_stream);
+    return true;
 }
 
 inline void slimm::get_considered_ranks()
@@ -513,120 +902,147 @@ inline void slimm::get_considered_ranks()
     }
 }
 
-inline uint32_t slimm::get_lca(std::set<uint32_t> const & ref_ids)
+// the taxon at the lowest rank shared by all (sorted) ref_ids. If there is
+// none the superkingdom of the reference with the highest id is used.
+inline uint32_t slimm::get_lca(std::vector<uint32_t> const & ref_ids) const
 {
-    uint32_t taxa_id = 1;
-    for (uint32_t i=0; i<LINAGE_LENGTH; ++i)
+    uint32_t rank = first_common_rank(ref_ids.size(), [this, &ref_ids](size_t i)
     {
-        std::set<uint32_t> level_taxa_set = {};
-        for(auto ref_id : ref_ids)
-        {
-            taxa_id = db.ac__taxid[references[ref_id].accession][i];
-            level_taxa_set.insert(taxa_id);
-        }
-        if(level_taxa_set.size() == 1)
-            break;
-    }
-    return taxa_id;
+        return lineage_of(ref_ids[i]);
+    });
+    if (rank < LINAGE_LENGTH)
+        return lineage_of(ref_ids[0])[rank];
+    return lineage_of(ref_ids.back())[LINAGE_LENGTH - 1];
 }
 
 inline void slimm::get_reads_lca_count()
 {
-    // put the non-unique read to upper taxa.
-    for (auto it= reads.begin(); it != reads.end(); ++it)
+    // (taxon, reference) pairs of the contributing children references of
+    // the taxa, they are made unique and summarized at the end
+    std::vector<std::pair<uint32_t, uint32_t> > taxon_refs;
+
+    // put the non-unique read to upper taxa, one class of reads at a time
+    int64_t classes_count = multi_reads.size();
+    std::vector<uint32_t> class_lca(classes_count, 0);
+    #pragma omp parallel for num_threads(get_usable_threads(options.threads)) schedule(dynamic, 1024)
+    for (int64_t i = 0; i < classes_count; ++i)
     {
-        size_t len = it->second.targets.size();
-        if(len > 1)
-        {
-            uint32_t lca_taxa_id = 0;
-            std::set<uint32_t> ref_ids = {};
-            std::set<uint32_t> taxon_ids;
-            size_t len = it->second.targets.size();
-            for (size_t i=0; i < len; ++i)
-            {
-                uint32_t ref_id = (it->second.targets[i]).reference_id;
-                ref_ids.insert(ref_id);
-            }
-            lca_taxa_id = get_lca(ref_ids);
-
-            increment_or_initialize(taxon_id__read_count, lca_taxa_id, 1u);
+        if(multi_reads[i].reference_ids.size() > 1)
+            class_lca[i] = get_lca(multi_reads[i].reference_ids);
+    }
 
-            //add the contributing children references to the taxa
-            taxon_id__children[lca_taxa_id].insert(ref_ids.begin(), ref_ids.end());
+    // (taxon, read count) of the LCAs, taxa are added to the maps in
+    // increasing order so the output does not depend on the order of classes
+    std::vector<std::pair<uint32_t, uint32_t> > lca_counts;
+    for (int64_t i = 0; i < classes_count; ++i)
+    {
+        read_class const & rc = multi_reads[i];
+        if(rc.reference_ids.size() > 1)
+        {
+            lca_counts.push_back(std::make_pair(class_lca[i], rc.reads_count));
+            for (auto ref_id : rc.reference_ids)
+                taxon_refs.push_back(std::make_pair(class_lca[i], ref_id));
         }
     }
-
-    //add the sum of read counts of children to all ancestors of the LCA // but get a copy first
-    std::unordered_map <uint32_t, uint32_t> taxon_id__read_count_cp = taxon_id__read_count;
-    uint32_t reciever_taxa_id = 0;
-    for (auto t_id : taxon_id__read_count_cp)
+    std::sort(lca_counts.begin(), lca_counts.end());
+    std::sort(taxon_refs.begin(), taxon_refs.end());
+    taxon_refs.erase(std::unique(taxon_refs.begin(), taxon_refs.end()), taxon_refs.end());
+
+    std::unordered_map <uint32_t, uint32_t> lca_read_count;
+    for (auto const & lca_count : lca_counts)
+        increment_or_initialize(lca_read_count, lca_count.first, lca_count.second);
+    taxon_id__read_count = lca_read_count;
+
+    //add the sum of read counts of children to all ancestors of the LCA
+    size_t lca_refs_count = taxon_refs.size();
+    for (size_t first = 0, last = 0; first < lca_refs_count; first = last)
     {
+        uint32_t lca_taxa_id = taxon_refs[first].first;
+        for (last = first; last < lca_refs_count && taxon_refs[last].first == lca_taxa_id; ++last);
+
         // get the rank of the taxid
-        taxa_ranks rnk = std::get<0>(db.taxid__name[t_id.first]);
+        taxa_ranks rnk = db.rank_of(lca_taxa_id);
 
         //get the first child and then the linage
-        std::string first_child_acc = "";
-        for (auto child : taxon_id__children.at(t_id.first))
-        {
-            first_child_acc = references[child].accession;
-            break;
-        }
-        std::vector<uint32_t> linage = db.ac__taxid[first_child_acc];
-        std::set<uint32_t> ref_ids = taxon_id__children[t_id.first];
+        uint32_t const * linage = lineage_of(taxon_refs[first].second);
 
         // add the read count to the uper ranks along the linage
         for (uint32_t j=rnk+1; j < LINAGE_LENGTH; ++j)
         {
-            reciever_taxa_id = linage[j];
-            increment_or_initialize(taxon_id__read_count, reciever_taxa_id, t_id.second);
+            increment_or_initialize(taxon_id__read_count, linage[j], lca_read_count[lca_taxa_id]);
 
             //add the contributing children references to the taxa
-            taxon_id__children[reciever_taxa_id].insert(ref_ids.begin(), ref_ids.end());
+            for (size_t k = first; k < last; ++k)
+                taxon_refs.push_back(std::make_pair(linage[j], taxon_refs[k].second));
         }
     }
 
-
     for (uint32_t i=0; i<length(references); ++i)
     {
         if (references[i].uniq_reads_count2 > 0)
         {
-            std::vector<uint32_t> linage = db.ac__taxid[references[i].accession];
-            std::set<uint32_t> ref_ids = taxon_id__children[linage[0]];
+            uint32_t const * linage = lineage_of(i);
             for (uint32_t j=1; j<LINAGE_LENGTH; ++j)
             {
-                reciever_taxa_id = linage[j];
-                auto tid_pos = taxon_id__read_count.find(reciever_taxa_id);
-                // If taxon_id already exists increment it
-                if(tid_pos != taxon_id__read_count.end())
-                    tid_pos->second += references[i].uniq_reads_count2;
-                else
-                    taxon_id__read_count[reciever_taxa_id] = references[i].uniq_reads_count2;
+                increment_or_initialize(taxon_id__read_count, linage[j], references[i].uniq_reads_count2);
 
                 //add the contributing children references to the taxa
-                taxon_id__children[reciever_taxa_id].insert(i);
-                taxon_id__children[reciever_taxa_id].insert(ref_ids.begin(), ref_ids.end());
+                taxon_refs.push_back(std::make_pair(linage[j], i));
             }
         }
     }
+
+    // summarize the children of every taxon
+    std::sort(taxon_refs.begin(), taxon_refs.end());
+    taxon_refs.erase(std::unique(taxon_refs.begin(), taxon_refs.end()), taxon_refs.end());
+    taxon_id__children.clear();
+    for (auto const & taxon_ref : taxon_refs)
+    {
+        auto tid_pos = taxon_id__children.find(taxon_ref.first);
+        if (tid_pos == taxon_id__children.end())
+        {
+            tid_pos = taxon_id__children.insert(std::make_pair(taxon_ref.first, taxon_children())).first;
+            tid_pos->second.first_child = taxon_ref.second;
+        }
+        tid_pos->second.last_child = taxon_ref.second;
+        tid_pos->second.genome_length += references[taxon_ref.second].length;
+        ++tid_pos->second.children_count;
+    }
 }
 
 inline void slimm::print_filter_stat()
 {
-    std::cerr << "  " << length(valid_ref_ids) << " passed the threshould coverage.\n";
-    std::cerr << "  " << failed_byCov << " ref's couldn't pass the coverage threshould.\n";
-    std::cerr << "  " << failed_byUniqCov << " ref's couldn't pass the uniq coverage threshould.\n";
-    std::cerr << "  uniquily matching reads increased from " << uniq_matches_count << " to " << uniq_matches_count2 <<"\n\n";
+    log() << "  " << length(valid_ref_ids) << " passed the threshould coverage.\n";
+    log() << "  " << failed_byCov << " ref's couldn't pass the coverage threshould.\n";
+    log() << "  " << failed_byUniqCov << " ref's couldn't pass the uniq coverage threshould.\n";
+    log() << "  uniquily matching reads increased from " << uniq_matches_count << " to " << uniq_matches_count2 <<"\n\n";
+}
+
+// how much of the file was read and used with --sample-fraction or --stop-tolerance
+inline void slimm::print_consumption(parallel_bgzf_istream const & bgzf_stream)
+{
+    log() << "  " << records_count << " records read, " << hits_count << " mapped records in the sample";
+    if (stopped_early)
+        log() << ", stopped early as the abundances converged";
+    // only known if the file was decompressed by parallel_bgzf_istream
+    uint64_t file_size = get_file_size(current_bam_file_path());
+    uint64_t bytes_read = bgzf_stream.compressed_bytes_read();
+    if (bytes_read > 0 && file_size > 0)
+        log() << "\n  about " << (bytes_read >> 20) << " of " << (file_size >> 20) << " MiB ("
+              << std::min<uint64_t>(100, bytes_read * 100 / file_size) << "%) of the file consumed";
+    log() << std::endl;
 }
 
 inline void slimm::print_matches_stat()
 {
-    std::cerr << "  "   << hits_count << " records processed." << std::endl;
-    std::cerr << "    " << matches_count << " matching reads" << std::endl;
-    std::cerr << "    " << uniq_matches_count << " uniquily matching reads"<< std::endl;
-    std::cerr << "  references with reads = " << reference_count << std::endl;
-    std::cerr << "  expected bins coverage = " << expected_coverage() <<std::endl;
-    std::cerr << "  bins coverage cut-off = " << coverage_cut_off() << " (" << options.cov_cut_off <<" quantile)\n";
-    std::cerr << "  uniq bins coverage cut-off = " << uniq_coverage_cut_off() << " (" << options.cov_cut_off <<" quantile)\n\n";
+    log() << "  "   << hits_count << " records processed." << std::endl;
+    log() << "    " << matches_count << " matching reads" << std::endl;
+    log() << "    " << uniq_matches_count << " uniquily matching reads"<< std::endl;
+    log() << "    " << multi_reads.size() << " classes of multi-matching reads" << std::endl;
+    log() << "  references with reads = " << reference_count << std::endl;
+    log() << "  expected bins coverage = " << expected_coverage() <<std::endl;
+    log() << "  bins coverage cut-off = " << coverage_cut_off() << " (" << options.cov_cut_off <<" quantile)\n";
+    log() << "  uniq bins coverage cut-off = " << uniq_coverage_cut_off() << " (" << options.cov_cut_off <<" quantile)\n\n";
 }
 
 uint32_t slimm::min_reads()
@@ -687,9 +1103,9 @@ float slimm::uniq_coverage_cut_off()
     return _uniq_coverage_cut_off;
 }
 
-std::string slimm::get_lineage_string (taxa_ranks rank, std::vector<uint32_t> const & linage)
+std::string slimm::get_lineage_string (taxa_ranks rank, uint32_t const * linage)
 {
-    std::string taxon_name = std::get<1>(db.taxid__name[linage[rank]]);
+    std::string taxon_name = db.name_of(linage[rank]);
     if (taxon_name == "")
     {
         taxon_name =  "unknown_" + from_taxa_ranks(rank);
@@ -699,7 +1115,7 @@ std::string slimm::get_lineage_string (taxa_ranks rank, std::vector<uint32_t> co
 
     for (uint32_t i=rank+1; i < LINAGE_LENGTH; ++i)
     {
-        taxon_name = std::get<1>(db.taxid__name[linage[i]]);
+        taxon_name = db.name_of(linage[i]);
         if (taxon_name == "")
         {
             taxon_name =  "unknown_" + from_taxa_ranks(taxa_ranks(i));
@@ -711,31 +1127,20 @@ std::string slimm::get_lineage_string (taxa_ranks rank, std::vector<uint32_t> co
 
 std::string slimm::get_lineage_string (taxa_ranks rank, uint32_t const & taxa_id)
 {
-    std::vector<uint32_t> linage;
+    static uint32_t const unknown_linage[LINAGE_LENGTH] = {0};
     if(taxa_id == 0)
-    {
-        linage.resize(LINAGE_LENGTH, 0);
-    }
-    else
-    {
-        std::string child_acc = "";
-        for (auto child : taxon_id__children.at(taxa_id))
-        {
-            child_acc = references[child].accession;
-            break;
-        }
-        linage = db.ac__taxid[child_acc];
-    }
-    return get_lineage_string(rank, linage);
+        return get_lineage_string(rank, unknown_linage);
+    auto tid_pos = taxon_id__children.find(taxa_id);
+    if(tid_pos == taxon_id__children.end())
+        return get_lineage_string(rank, unknown_linage);
+    return get_lineage_string(rank, lineage_of(tid_pos->second.first_child));
 }
 
 
-inline void slimm::write_abundance()
+// fills profile with the abundances of the taxa at the considered rank
+inline void slimm::get_abundance_rows()
 {
-    std::string abundunce_tsv_path = get_tsv_file_name(toCString(options.output_prefix), current_bam_file_path(), "_profile");
-    std::ofstream abundunce_stream(abundunce_tsv_path);
-    abundunce_stream << "taxa_level\ttaxa_id\tlinage\tabundance\tread_count\n";
-
+    profile.clear();
     taxa_ranks rank = considered_ranks[1];
     taxa_ranks parent_rank = considered_ranks[0];
 
@@ -746,17 +1151,8 @@ inline void slimm::write_abundance()
     //get a hold of information at the upper taxon level
     for (auto t_id : taxon_id__read_count)
     {
-        if (std::get<0>(db.taxid__name[t_id.first]) == parent_rank)
+        if (db.rank_of(t_id.first) == parent_rank)
         {
-            uint32_t genome_Length = 0;
-            uint32_t children_count = 0;
-            for (auto child : taxon_id__children.at(t_id.first))
-            {
-                genome_Length += references[child].length;
-                ++children_count;
-            }
-            genome_Length = genome_Length/children_count;
-
             float abundance = float(t_id.second)/(matches_count) * 100;
             // New resolution into the unclassifieds
             parent_abundance[t_id.first] = abundance;
@@ -775,23 +1171,15 @@ inline void slimm::write_abundance()
     
     for (auto t_id : taxon_id__read_count)
     {
-        if (std::get<0>(db.taxid__name[t_id.first]) == rank)
+        if (db.rank_of(t_id.first) == rank)
         {
-            uint32_t genome_Length = 0;
-            uint32_t children_count = 0;
-            std::string child_acc = "";
-            for (auto child : taxon_id__children.at(t_id.first))
-            {
-                genome_Length += references[child].length;
-                child_acc = references[child].accession;
-                ++children_count;
-            }
-            genome_Length = genome_Length/children_count;
+            taxon_children const & children = taxon_id__children.at(t_id.first);
+            uint32_t genome_Length = children.genome_length/children.children_count;
 
-            std::vector<uint32_t> linage = db.ac__taxid[child_acc];
+            uint32_t const * linage = lineage_of(children.last_child);
             float cov = float(t_id.second * avg_read_length)/genome_Length;
             float abundance = float(t_id.second)/(matches_count) * 100;
-            std::string candidate_name = std::get<1>(db.taxid__name[t_id.first]);
+            std::string candidate_name = db.name_of(t_id.first);
 
             // agregate the statstics of the children by parent
             uint32_t parent_tax_id = linage[parent_rank];
@@ -802,9 +1190,8 @@ inline void slimm::write_abundance()
                 ++faild_count;
                 continue;
             }
-            std::string linage_str = get_lineage_string(rank, t_id.first);
-            abundunce_stream << from_taxa_ranks(rank) << "\t" << t_id.first << "\t" << linage_str << "\t";
-            abundunce_stream << abundance << "\t" << t_id.second << "\n";
+            profile.emplace_back(rank, std::to_string(t_id.first), get_lineage_string(rank, t_id.first),
+                                 abundance, t_id.second);
 
             sum_abundunce += abundance;
             sum_reads_count += t_id.second;
@@ -818,67 +1205,185 @@ inline void slimm::write_abundance()
         uint32_t parent_taxid = ab_by_parent.first;
         float uncl_abundance = parent_abundance[parent_taxid] - sum_abundunce_by_parent[parent_taxid];
         uint32_t unc_read_count = parent_reads_count[parent_taxid] - sum_reads_count_by_parent[parent_taxid];
-        std::string candidate_name = std::get<1>(db.taxid__name[parent_taxid]) + "_unclassified";
+        std::string candidate_name = db.name_of(parent_taxid) + "_unclassified";
         if (uncl_abundance > options.abundance_cut_off && candidate_name != "_unclassified")
         {
             std::string linage_str = get_lineage_string(parent_rank, parent_taxid) + "|" + from_taxa_ranks_short(rank) + "__" + candidate_name;
 
-            abundunce_stream << from_taxa_ranks(rank) << "\t" << parent_taxid << "*\t" << linage_str << "\t";
-            abundunce_stream << uncl_abundance << "\t" << unc_read_count << "\n";
+            profile.emplace_back(rank, std::to_string(parent_taxid) + "*", linage_str, uncl_abundance, unc_read_count);
             sum_reads_count += unc_read_count;
             sum_abundunce += uncl_abundance;
         }
     }
 
-    std::string linage_str = get_lineage_string(rank, 0);
-    abundunce_stream << from_taxa_ranks(rank) << "\t" << "0*" << "\t" << linage_str << "\t";
-    abundunce_stream << 100.0 - sum_abundunce << "\t" << matches_count - sum_reads_count << "\n";
+    profile.emplace_back(rank, "0*", get_lineage_string(rank, uint32_t(0)),
+                         100.0 - sum_abundunce, matches_count - sum_reads_count);
     if (options.verbose)
     {
-        std::cerr << "\n" << std::setw (4) << count << std::setw (15) << from_taxa_ranks(rank) <<" ("
+        log() << "\n" << std::setw (4) << count << std::setw (15) << from_taxa_ranks(rank) <<" ("
         << faild_count <<" bellow cutoff i.e. "<< options.abundance_cut_off <<")";
     }
+}
+
+inline void slimm::write_abundance()
+{
+    get_abundance_rows();
 
+    // written next to the profile and renamed so readers never see a partial (e.g. interim) profile
+    std::string abundunce_tsv_path = get_tsv_file_name(toCString(options.output_prefix), current_bam_file_path(), "_profile");
+    std::string tmp_tsv_path = abundunce_tsv_path + ".tmp";
+    std::ofstream abundunce_stream(tmp_tsv_path);
+    abundunce_stream << "taxa_level\ttaxa_id\tlinage\tabundance\tread_count\n";
+    for (profile_row const & row : profile)
+    {
+        abundunce_stream << from_taxa_ranks(row.rank) << "\t" << row.taxa_id << "\t" << row.linage << "\t";
+        abundunce_stream << row.abundance << "\t" << row.reads_count << "\n";
+    }
     abundunce_stream.close();
+    if (std::rename(tmp_tsv_path.c_str(), abundunce_tsv_path.c_str()) != 0)
+    {
+        std::remove(abundunce_tsv_path.c_str());
+        std::rename(tmp_tsv_path.c_str(), abundunce_tsv_path.c_str());
+    }
 }
 
+// Profiles what is read so far in the background while reading goes on.
+// The copy is filtered, its reads are assigned to LCAs and its profile
+// replaces _profile.tsv. Input grouped by read name is accounted while
+// reading, so its state is copied. Reads of other input are accounted in
+// the background into _interim_reads, which only gets the reads added to
+// the read table since the last interim profile (a read that gets more
+// targets later keeps the ones it had for the interim profiles, the final
+// profile accounts all reads again). A trigger is skipped while the
+// previous interim profile is being written.
+inline void slimm::start_interim_profile()
+{
+    if (_interim_running)
+        return;
+    if (_interim_thread.joinable())
+        _interim_thread.join();
+
+    std::shared_ptr<slimm> snapshot = std::make_shared<slimm>(options, db, ref_tables, _bam_file_path);
+    snapshot->avg_read_length = avg_read_length;
+    snapshot->name_grouped = name_grouped;
+    snapshot->reference_info = reference_info;
+    snapshot->hits_count = hits_count;
+    // the rest runs next to the reading of the file
+    snapshot->options.threads = 1;
+    snapshot->buffer_log();
+
+    std::shared_ptr<std::vector<read_stat> > new_reads;
+    if (name_grouped)
+    {
+        snapshot->references = references;
+        snapshot->multi_reads = multi_reads;
+        snapshot->matches_count = matches_count;
+        snapshot->uniq_matches_count = uniq_matches_count;
+        snapshot->uniq_hits_count = uniq_hits_count;
+    }
+    else
+    {
+        if (!_interim_reads)
+        {
+            _interim_reads = std::make_shared<slimm>(options, db, ref_tables, _bam_file_path);
+            _interim_reads->options.threads = 1;
+            _interim_reads->references = references;
+        }
+        new_reads = std::make_shared<std::vector<read_stat> >(reads.begin() + _interim_reads_count, reads.end());
+        _interim_reads_count = reads.size();
+    }
+
+    if (options.verbose)
+        log() << "\n  interim profile after " << hits_count << " records ... ";
 
-inline void slimm::write_coverage()
+    _interim_hits_count = hits_count;
+    _interim_time = std::chrono::steady_clock::now();
+    _interim_running = true;
+    std::shared_ptr<slimm> accounted = _interim_reads;
+    _interim_thread = std::thread([this, snapshot, accounted, new_reads]()
+    {
+        if (new_reads)
+        {
+            for (auto const & read : *new_reads)
+            {
+                accounted->account_read(read);
+                if (!read.is_uniq())
+                    accounted->multi_reads.add(read);
+            }
+            snapshot->references = accounted->references;
+            snapshot->multi_reads = accounted->multi_reads;
+            snapshot->matches_count = accounted->matches_count;
+            snapshot->uniq_matches_count = accounted->uniq_matches_count;
+            snapshot->uniq_hits_count = accounted->uniq_hits_count;
+        }
+        snapshot->multi_reads.compact();
+        snapshot->write_interim_profile();
+        _interim_running = false;
+    });
+}
+
+inline void slimm::wait_for_interim_profile()
 {
-    std::string coverge_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_coverge");
-    std::string uniq_coverge_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_uniq_coverge");
-    std::string uniq_coverge2_csv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_uniq_coverge2");
+    if (_interim_thread.joinable())
+        _interim_thread.join();
+}
 
-    std::ofstream coverge_stream(coverge_csv_path);
-    std::ofstream uniq_coverge_stream(uniq_coverge_csv_path);
-    std::ofstream uniq_coverge2_stream(uniq_coverge2_csv_path);
+// the steps of get_profiles() after reading, on a snapshot
+inline void slimm::write_interim_profile()
+{
+    if (matches_count == 0)
+        return;
+    compute_abundances();
+    if (options.min_reads == 0)
+        options.min_reads = 1 + ((matches_count - 1) / 10000);
+    filter_alignments();
+    get_reads_lca_count();
+    write_abundance();
+}
 
 
-    for (auto valid_id : valid_ref_ids)
+inline void slimm::write_coverage()
+{
+    std::vector<std::string> coverage_paths = {
+        get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_coverge"),
+        get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_uniq_coverge"),
+        get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_uniq_coverge2")};
+    std::vector<uint32_t> ref_ids(valid_ref_ids.begin(), valid_ref_ids.end());
+
+    // the three files are formatted at the same time
+    #pragma omp parallel for num_threads(std::min(3u, get_usable_threads(options.threads))) schedule(static, 1)
+    for (int32_t f = 0; f < 3; ++f)
     {
-        reference_contig current_ref = references[valid_id];
-        coverge_stream  << current_ref.accession;
-        uniq_coverge_stream  << current_ref.accession;
-        uniq_coverge2_stream  << current_ref.accession;
-        for (uint32_t b=0; b < current_ref.cov.number_of_bins; ++b)
+        buffered_writer coverage_writer(coverage_paths[f]);
+        for (uint32_t ref_id : ref_ids)
         {
-            coverge_stream  << "," << current_ref.cov.bins_height[b];
-            uniq_coverge_stream  << "," << current_ref.uniq_cov.bins_height[b];
-            uniq_coverge2_stream  << "," << current_ref.uniq_cov2.bins_height[b];
+            reference_contig const & current_ref = references[ref_id];
+            bins_coverage const & coverage = f == 0 ? current_ref.cov : (f == 1 ? current_ref.uniq_cov : current_ref.uniq_cov2);
+
+            // mostly empty bins are written without looking at each of them
+            uint32_t next_bin = 0;
+            coverage_writer << accession(ref_id);
+            coverage.for_each_none_zero_bin([&](uint32_t bin_number, uint32_t height)
+            {
+                for (; next_bin < bin_number && next_bin < current_ref.cov.number_of_bins; ++next_bin)
+                    coverage_writer.write(",0", 2);
+                if (next_bin < current_ref.cov.number_of_bins)
+                {
+                    coverage_writer << ',' << height;
+                    ++next_bin;
+                }
+            });
+            for (; next_bin < current_ref.cov.number_of_bins; ++next_bin)
+                coverage_writer.write(",0", 2);
+            coverage_writer << '\n';
         }
-        coverge_stream  << "\n" ;
-        uniq_coverge_stream  << "\n";
-        uniq_coverge2_stream  << "\n";
     }
-    coverge_stream.close();
-    uniq_coverge_stream.close();
-    uniq_coverge2_stream.close();
 }
 
 inline void slimm::write_raw_stat()
 {
     std::string raw_tsv_path = get_tsv_file_name(options.output_prefix, current_bam_file_path(), "_raw");
-    std::ofstream features_stream(raw_tsv_path);
+    buffered_writer features_stream(raw_tsv_path);
 
     features_stream <<"accesion\t"
                       "taxaid\t"
@@ -905,11 +1410,14 @@ inline void slimm::write_raw_stat()
 
     for (uint32_t i=0; i < length(references); ++i)
     {
-        reference_contig current_ref = references[i];
-        std::string candidate_name = std::get<1>(db.taxid__name[current_ref.taxa_id]);
+        // references without reads have nothing to report
+        reference_contig & current_ref = references[i];
+        if (current_ref.reads_count == 0)
+            continue;
+        std::string candidate_name = db.name_of(current_ref.taxa_id);
         if (candidate_name == "")
             candidate_name = "no_name_found";
-        features_stream   << current_ref.accession << "\t"
+        features_stream   << accession(i) << "\t"
                           << current_ref.taxa_id << "\t"
                           << candidate_name << "\t"
                           << current_ref.reads_count << "\t"
@@ -938,27 +1446,226 @@ inline void slimm::write_raw_stat()
 }
 
 
+//collect the sam files to process
+inline std::vector<std::string> collect_bam_files(arg_options const & options)
+{
+    std::vector<std::string> input_paths;
+    if (options.is_directory)
+    {
+        input_paths = get_bam_files_in_directory(options.input_path);
+        if (options.verbose)
+            std::cerr << length(input_paths) << " SAM/BAM Files found under the directory: " << options.input_path << "!\n";
+    }
+    else
+    {
+        if (is_file(toCString(options.input_path)))
+            input_paths.push_back(options.input_path);
+        else
+        {
+            std::cerr << options.input_path << " is not a file use -d option for a directory.\n";
+            exit(1);
+        }
+    }
+    return input_paths;
+}
+
 inline int get_taxonomic_profile(arg_options & options)
 {
-    // slimm object
     Timer<>  stop_watch;
-    uint32_t total_hits_count = 0;
-    slimm slimm1(options);
-    for (uint32_t n=0; n < slimm1.number_of_files; ++n)
+    uint64_t total_hits_count = 0;
+    std::vector<std::string> input_paths = collect_bam_files(options);
+
+    // the database is loaded once and shared (read only) by all files
+    slimm_database db;
+    load_slimm_database(db, options.database_path);
+    reference_table_cache ref_tables(options.database_path, options.reference_cache);
+
+    // use at most 80% of the installed memory unless told otherwise
+    uint64_t memory_budget = uint64_t(options.max_memory) << 20;
+    if (memory_budget == 0)
+        memory_budget = get_physical_memory() / 10 * 8;
+
+    // the sample x taxon matrix of all files, filled as they are done
+    std::vector<std::string> sample_names;
+    for (std::string const & input_path : input_paths)
+        sample_names.push_back(get_sample_name(input_path));
+    profile_matrix merged_profiles(sample_names);
+
+    std::mutex log_mutex;
+    profile_scheduler scheduler(options.jobs, memory_budget);
+    std::vector<uint32_t> failed_files = scheduler.run(input_paths, [&](uint32_t n) -> bool
     {
-        slimm1.reset();
+        // every file gets its own slimm object
+        slimm slimm1(options, db, ref_tables, input_paths[n]);
         slimm1.current_file_index = n;
-        slimm1.get_profiles();
+        slimm1.number_of_files = length(input_paths);
+        if (options.jobs > 1)
+            slimm1.buffer_log();
+        bool profiled = slimm1.get_profiles();
+        if (profiled && options.merged_profile)
+            merged_profiles.add(n, slimm1.profile);
+
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << slimm1.buffered_log();
         total_hits_count += slimm1.hits_count;
-    }
+        return profiled;
+    });
 
     std::string output_directory = get_directory(options.output_prefix);
+    if (options.merged_profile)
+    {
+        // named apart from the per sample profiles, which may share the prefix
+        std::string prefix_name = get_file_name(options.output_prefix);
+        std::string merged_path = output_directory + "/" + (prefix_name.empty() ? "" : prefix_name + "_") + "merged_matrix";
+        std::string merged_tsv_path = merged_path + ".tsv";
+        std::string merged_binary_path = merged_path + ".slmx";
+        if (!merged_profiles.write_tsv(merged_tsv_path) || !merged_profiles.write_binary(merged_binary_path))
+            std::cerr << "[ERROR] Unable to write the merged profile " << merged_tsv_path << "!\n";
+    }
 
     std::cerr << "\n*****************************************************************\n";
     std::cerr << total_hits_count << " SAM/BAM alignment records are proccessed.\n";
     std::cerr << "Taxonomic profiles are written to: \n   " << output_directory <<"\n";
     std::cerr << "Total time elapsed: " << stop_watch.elapsed() <<" secs\n";
 
+    if (!failed_files.empty())
+    {
+        std::cerr << "[ERROR] " << failed_files.size() << " of " << input_paths.size() << " files could not be profiled:\n";
+        for (uint32_t n : failed_files)
+            std::cerr << "   " << input_paths[n] << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+// Function set_profile_option()
+// --------------------------------------------------------------------------
+// sets an option of a profiling request (slimm serve) from its long name,
+// returns false for unknown options and invalid values
+inline bool set_profile_option(arg_options & options, std::string const & name, std::string const & value)
+{
+    std::istringstream value_stream(value);
+    bool flag = value == "true" || value == "1";
+    if (name == "bin-width")
+        value_stream >> options.bin_width;
+    else if (name == "min-reads")
+        value_stream >> options.min_reads;
+    else if (name == "threads")
+        value_stream >> options.threads;
+    else if (name == "sample-fraction")
+        value_stream >> options.sample_fraction;
+    else if (name == "stop-tolerance")
+        value_stream >> options.stop_tolerance;
+    else if (name == "stop-interval")
+        value_stream >> options.stop_interval;
+    else if (name == "interim-records")
+        value_stream >> options.interim_records;
+    else if (name == "interim-seconds")
+        value_stream >> options.interim_seconds;
+    else if (name == "cov-cut-off")
+        value_stream >> options.cov_cut_off;
+    else if (name == "abundance-cut-off")
+        value_stream >> options.abundance_cut_off;
+    else if (name == "rank" && std::find(options.rankList.begin(), options.rankList.end(), value) != options.rankList.end())
+        options.rank = value;
+    else if (name == "read-keys" && std::find(options.readKeysList.begin(), options.readKeysList.end(), value) != options.readKeysList.end())
+        options.read_keys = value;
+    else if (name == "name-grouped")
+        options.name_grouped = flag;
+    else if (name == "raw-output")
+        options.raw_output = flag;
+    else if (name == "coverage-output")
+        options.coverage_output = flag;
+    else if (name == "verbose")
+        options.verbose = flag;
+    else
+        return false;
+    return !value_stream.fail() && options.threads > 0 && options.stop_interval > 0 &&
+           options.sample_fraction > 0.0 && options.sample_fraction <= 1.0 &&
+           options.cov_cut_off >= 0.0 && options.cov_cut_off <= 1.0;
+}
+
+// --------------------------------------------------------------------------
+// Function serve_taxonomic_profiles()
+// --------------------------------------------------------------------------
+// slimm serve: loads the database once and profiles the SAM/BAM files that
+// are requested on a local socket, one request per line:
+//   PROFILE <SAM/BAM path> [<output prefix>] [<option>=<value> ...]
+// answered with "OK <records> <msecs>" or "ERROR <message>". Options are the
+// long names of slimm's options (e.g. rank=genus). Up to --jobs requests
+// are profiled at the same time within the memory budget, others wait.
+inline int serve_taxonomic_profiles(arg_options & options, std::string const & socket_path)
+{
+    slimm_database db;
+    load_slimm_database(db, options.database_path);
+    reference_table_cache ref_tables(options.database_path, options.reference_cache);
+
+    uint64_t memory_budget = uint64_t(options.max_memory) << 20;
+    if (memory_budget == 0)
+        memory_budget = get_physical_memory() / 10 * 8;
+
+    profile_server server(socket_path);
+    if (!server.open())
+        return 1;
+    std::cerr << "[MSG] serving taxonomic profiles on " << socket_path << "\n";
+
+    std::mutex log_mutex;
+    profile_scheduler scheduler(options.jobs, memory_budget);
+    server.serve([&](std::vector<std::string> const & request) -> std::string
+    {
+        if (request.empty())
+            return "ERROR empty request";
+        if (request[0] == "PING")
+            return "OK";
+        if (request[0] != "PROFILE" || request.size() < 2)
+            return "ERROR unknown request, expected PROFILE <SAM/BAM path> [<output prefix>] [<option>=<value> ...]";
+
+        arg_options job_options = options;
+        job_options.input_path = request[1];
+        job_options.output_prefix = options.output_prefix.empty() ? request[1] : options.output_prefix;
+        for (uint32_t i = 2; i < request.size(); ++i)
+        {
+            size_t equal_pos = request[i].find('=');
+            if (equal_pos == std::string::npos && i == 2)
+                job_options.output_prefix = request[i];
+            else if (equal_pos == std::string::npos ||
+                     !set_profile_option(job_options, request[i].substr(0, equal_pos), request[i].substr(equal_pos + 1)))
+                return "ERROR invalid option " + request[i];
+        }
+        if (!is_file(job_options.input_path.c_str()))
+            return "ERROR " + job_options.input_path + " is not a file";
+
+        Timer<std::chrono::milliseconds> stop_watch;
+        uint64_t memory = estimate_profile_memory(job_options.input_path);
+        scheduler.admit(memory);
+        std::string reply;
+        try
+        {
+            slimm slimm1(job_options, db, ref_tables, job_options.input_path);
+            slimm1.number_of_files = 1;
+            slimm1.buffer_log();
+            if (slimm1.get_profiles())
+                reply = "OK " + std::to_string(slimm1.hits_count) + " " + std::to_string(uint64_t(stop_watch.elapsed()));
+            else
+                reply = "ERROR unable to read " + job_options.input_path;
+
+            std::lock_guard<std::mutex> lock(log_mutex);
+            std::cerr << slimm1.buffered_log();
+        }
+        catch (std::exception const & e)
+        {
+            reply = std::string("ERROR ") + e.what();
+        }
+        catch (char const * message)
+        {
+            reply = std::string("ERROR ") + message;
+        }
+        scheduler.release(memory);
+        return reply;
+    });
+
+    std::cerr << "[MSG] slimm serve is shut down.\n";
     return 0;
 }
 
@@ -45,6 +45,9 @@
 
 #include "misc.hpp"
 #include "file_helper.hpp"
+#include "fasta_scanner.hpp"
+#include "accession_map.hpp"
+#include "taxonomy.hpp"
 
 using namespace seqan;
 
@@ -54,19 +57,25 @@ using namespace seqan;
 struct arg_options
 {
     uint32_t                     batch;
+    uint32_t                     threads;
     bool                         verbose;
     std::string                  fasta_path;
+    std::string                  database_path;
     std::string                  nodes_path;
     std::string                  names_path;
     std::string                  output_path;
+    std::string                  format;
     std::vector<std::string>     ac__taxid_paths;
 
     arg_options() : batch(1000000),
+                    threads(1),
                     verbose(false),
                     fasta_path(),
+                    database_path(),
                     nodes_path(),
                     names_path(),
                     output_path("slimm_db.sldb"),
+                    format("v2"),
                     ac__taxid_paths() {}
 };
 
@@ -84,13 +93,16 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
     setDescription(parser);
     // Define usage line and long description.
     addUsageLine(parser, "-nm \"\\fINAMES.dmp\\fP\" -nd \"\\fINODES.dmp\\fP\" -o \"\\fISLIMM.sldb\\fP\" [\\fIOPTIONS\\fP] \"\\fIFASTA\\fP\" \"\\fIACCESSION2TAXAID\\fP\"  [\\fIACCESSION2TAXAID_2 ...\\fP]");
+    addUsageLine(parser, "update -d \"\\fIOLD.sldb\\fP\" -o \"\\fISLIMM.sldb\\fP\" [\\fIOPTIONS\\fP] \"\\fIFASTA|ACCESSIONS\\fP\" \"\\fIACCESSION2TAXAID\\fP\"  [\\fIACCESSION2TAXAID_2 ...\\fP]");
+    addUsageLine(parser, "index -o \"\\fIACCESSION2TAXAID.a2t\\fP\" \"\\fIACCESSION2TAXAID\\fP\"  [\\fIACCESSION2TAXAID_2 ...\\fP]");
 
     addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "FASTA FILE"));
     setValidValues(parser, 0, SeqFileIn::getFileExtensions());
     setHelpText(parser, 0, "A multi-fasta file used as a reference for mapping");
 
     addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "ACCESSION2TAXAID MAP FILES", true));
-    setHelpText(parser, 1, "one ore more accession to taxa id mapping files dowloaded from ncbi (separated by space.)");
+    setHelpText(parser, 1, "one ore more accession to taxa id mapping files dowloaded from ncbi (separated by space.) "
+                           "Plain, gzipped or converted with slimm_build index.");
 
     // The output file argument.
     addOption(parser, ArgParseOption("o", "output-file", "The path to the output file (default slimm_db.sldb)",
@@ -98,6 +110,12 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
     setValidValues(parser, "output-file", ".sldb");
     setDefaultValue(parser, "output-file", options.output_path);
 
+    addOption(parser, ArgParseOption("f", "format", "The database format. \\fIv2\\fP is used in place (memory mapped) "
+                                     "by slimm, \\fIv1\\fP is the format of older versions of slimm.",
+                                     ArgParseOption::STRING));
+    setValidValues(parser, "format", "v1 v2");
+    setDefaultValue(parser, "format", options.format);
+
     addOption(parser, ArgParseOption("nm", "names", "NCBI's names.dmp file which contains the mapping of taxaid to name",
                              ArgParseArgument::INPUT_FILE));
     setRequired(parser, "names");
@@ -106,10 +124,15 @@ void setupArgumentParser(ArgumentParser & parser, arg_options const & options)
                              ArgParseArgument::INPUT_FILE));
     setRequired(parser, "nodes");
 
-    addOption(parser, ArgParseOption("b", "batch", "maximum number of mapping to load to memory. (default=1000000)",
+    addOption(parser, ArgParseOption("b", "batch", "Not used anymore, mapping files are streamed. Kept for compatibility.",
                              ArgParseArgument::INTEGER, "INT"));
     setDefaultValue(parser, "batch", options.batch);
 
+    addOption(parser, ArgParseOption("t", "threads", "Number of threads used to scan the FASTA file and the mapping files.",
+                             ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "threads", "1");
+    setDefaultValue(parser, "threads", options.threads);
+
     addOption(parser, ArgParseOption("v", "verbose", "Enable verbose output."));
 }
 
@@ -136,8 +159,12 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
 
     if (isSet(parser, "output-file"))
         getOptionValue(options.output_path, parser, "output-file");
+    if (isSet(parser, "format"))
+        getOptionValue(options.format, parser, "format");
     if (isSet(parser, "batch"))
         getOptionValue(options.batch, parser, "batch");
+    if (isSet(parser, "threads"))
+        getOptionValue(options.threads, parser, "threads");
     if (isSet(parser, "verbose"))
         getOptionValue(options.verbose, parser, "verbose");
 
@@ -145,12 +172,93 @@ parseCommandLine(ArgumentParser & parser, arg_options & options, int argc, char
 }
 
 
+// ----------------------------------------------------------------------------
+// Class index_options
+// ----------------------------------------------------------------------------
+struct index_options
+{
+    bool                         verbose;
+    std::string                  output_path;
+    std::vector<std::string>     ac__taxid_paths;
+
+    index_options() : verbose(false),
+                      output_path("accession2taxid.a2t"),
+                      ac__taxid_paths() {}
+};
+
+// --------------------------------------------------------------------------
+// Function setup_index_argument_parser()
+// --------------------------------------------------------------------------
+void setup_index_argument_parser(ArgumentParser & parser, index_options const & options)
+{
+    setAppName(parser, "slimm_build index");
+    setShortDescription(parser, "converts accession to taxa id mapping files into a binary index");
+    setCategory(parser, "Metagenomics");
+
+    setDateAndVersion(parser);
+    addDescription(parser, "The index can be given to slimm_build instead of the mapping files "
+                           "and is much faster to search than the text files.");
+    addUsageLine(parser, "-o \"\\fIACCESSION2TAXAID.a2t\\fP\" \"\\fIACCESSION2TAXAID\\fP\"  [\\fIACCESSION2TAXAID_2 ...\\fP]");
+
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "ACCESSION2TAXAID MAP FILES", true));
+    setHelpText(parser, 0, "one ore more accession to taxa id mapping files dowloaded from ncbi (plain or gzipped.)");
+
+    addOption(parser, ArgParseOption("o", "output-file", "The path to the output file (default accession2taxid.a2t)",
+                                     ArgParseArgument::OUTPUT_FILE));
+    setValidValues(parser, "output-file", ".a2t");
+    setDefaultValue(parser, "output-file", options.output_path);
+
+    addOption(parser, ArgParseOption("v", "verbose", "Enable verbose output."));
+}
+
+// --------------------------------------------------------------------------
+// Function index_main()
+// --------------------------------------------------------------------------
+// slimm_build index
+int index_main(int argc, char const ** argv)
+{
+    ArgumentParser parser;
+    index_options options;
+    setup_index_argument_parser(parser, options);
+
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+    if (res != ArgumentParser::PARSE_OK)
+        return res == ArgumentParser::PARSE_ERROR;
+
+    uint32_t acc__taxaid_count = getArgumentValueCount(parser, 0);
+    options.ac__taxid_paths.resize(acc__taxaid_count);
+    for (uint32_t i = 0; i < acc__taxaid_count; ++i)
+        getArgumentValue(options.ac__taxid_paths[i], parser, 0, i);
+    if (isSet(parser, "output-file"))
+        getOptionValue(options.output_path, parser, "output-file");
+    if (isSet(parser, "verbose"))
+        options.verbose = true;
+
+    std::cerr <<"[MSG] indexing accession to taxaid mappings ...\n";
+    if (!build_accession_index(options.ac__taxid_paths, options.output_path, options.verbose))
+        return 1;
+    std::cerr <<"[MSG] accession index is written to " << options.output_path << "\n";
+    return 0;
+}
+
 // --------------------------------------------------------------------------
 // Function get_accession_numbers()
 // --------------------------------------------------------------------------
+// uses the FASTA index (FASTA.fai) if there is one, otherwise only the header
+// lines of uncompressed files are scanned. Compressed files are parsed.
 inline void get_accession_numbers(std::set<std::string> & accessions, arg_options const & options)
 {
     std::cerr <<"[MSG] getting accessions numbers from fasta file ...\n";
+    std::vector<std::string> found_accessions;
+    std::string fai_path = options.fasta_path + ".fai";
+    if ((is_file(fai_path.c_str()) && get_fai_accessions(found_accessions, fai_path)) ||
+        (!is_compressed_file(options.fasta_path) &&
+         scan_fasta_accessions(found_accessions, options.fasta_path, options.threads)))
+    {
+        accessions.insert(found_accessions.begin(), found_accessions.end());
+        return;
+    }
+
     CharString id;
     IupacString seq;
 
@@ -169,31 +277,6 @@ inline void get_accession_numbers(std::set<std::string> & accessions, arg_option
     close(fasta_file);
 }
 
-// --------------------------------------------------------------------------
-// Function get_batch_mappings_ac__taxid()
-// --------------------------------------------------------------------------
-inline bool get_batch_mappings_ac__taxid(std::unordered_map<std::string, uint32_t> & ac__taxid_map,
-                                         std::ifstream & ac__taxid_stream,
-                                         uint32_t const batch_size)
-{
-    ac__taxid_map.clear();
-    uint32_t taxid = 0, lines_count = 0;
-    std::string ac, line, ignore;
-
-    while(std::getline(ac__taxid_stream, line))
-    {
-        std::stringstream   linestream(line);
-        std::getline(linestream, ac, '\t'); // first column is accesion
-        std::getline(linestream, ignore, '\t'); // skip the second column (accesion with version)
-        linestream >> taxid;// third column is taxid
-        ac__taxid_map[ac]=taxid;
-        lines_count++;
-        if (lines_count >= batch_size)
-            break;
-    }
-    return (lines_count!=0);
-}
-
 // --------------------------------------------------------------------------
 // Function print_missed_accessions()
 // --------------------------------------------------------------------------
@@ -226,50 +309,23 @@ inline void get_taxid_from_accession(slimm_database & slimm_db,
 {
 
     std::cerr <<"[MSG] mapping accessions to taxaid ...\n";
-    uint32_t accessions_count = accessions.size();
-    uint32_t map_file_number  = 1;
-    // iterate over multiple files
-    for(std::string map_path : options.ac__taxid_paths)
+    std::vector<std::string> wanted_accessions(accessions.begin(), accessions.end());
+    std::vector<uint32_t> taxids = map_accessions_to_taxids(wanted_accessions,
+                                                            options.ac__taxid_paths,
+                                                            options.threads,
+                                                            options.verbose);
+
+    for (uint32_t i = 0; i < wanted_accessions.size(); ++i)
     {
-        if (accessions.size() == 0) // if all accesions are accounted for
-            return;
-        std::unordered_map<std::string, uint32_t> ac__taxid_map;
-        std::ifstream ac__taxid_stream(map_path);
-
-        // iterate over a batch of mappings: for memory sake
-        uint32_t iter_number  = 1;
-        while(get_batch_mappings_ac__taxid(ac__taxid_map, ac__taxid_stream, options.batch))
-        {
-            if (accessions.size() == 0) // if all accesions are accounted for
-                return;
-            if (options.verbose)
-            {
-                std::cerr << "[VERBOSE MSG] mapping file: ["<< map_file_number <<"/"<< options.ac__taxid_paths.size() << "]\t";
-                std::cerr << "iter: [" << iter_number << "]\t";
-                std::cerr << "accessions left: ["<< accessions.size() << "/" << accessions_count <<"]\n";
-                ++iter_number;
-            }
-            // iterate over the remaining accessions to get
-            for(auto ac_it=accessions.begin(); ac_it != accessions.end();)
-            {
-                auto ac_pos = ac__taxid_map.find(*ac_it);
-                if(ac_pos != ac__taxid_map.end())
-                {
-                    //insert the found accessions in to the DB
-                    slimm_db.ac__taxid[*ac_it] = std::vector<uint32_t>(LINAGE_LENGTH, 0);
-                    slimm_db.ac__taxid[*ac_it][0] = ac_pos->second;
-
-                    //remove found accessions form the set
-                    ac_it = accessions.erase(ac_it);
-                }
-                else
-                {
-                    ++ac_it;
-                }
-            }
-        }
-        ac__taxid_stream.close();
-        ++map_file_number;
+        if (taxids[i] == ACCESSION_NOT_FOUND)
+            continue;
+        //insert the found accessions in to the DB
+        std::vector<uint32_t> & linage = slimm_db.ac__taxid[wanted_accessions[i]];
+        linage.resize(LINAGE_LENGTH, 0);
+        linage[0] = taxids[i];
+
+        //remove found accessions form the set
+        accessions.erase(wanted_accessions[i]);
     }
 
     // some accessions are still not mapped
@@ -277,72 +333,253 @@ inline void get_taxid_from_accession(slimm_database & slimm_db,
         print_missed_accessions(accessions, options);
 }
 
+// --------------------------------------------------------------------------
+// Function add_taxonomic_linage()
+// --------------------------------------------------------------------------
+// fills the linage of an accession from its taxid (linage[0]) and adds its taxa to the database
+inline void add_taxonomic_linage(slimm_database & slimm_db, taxonomy & taxa, std::vector<uint32_t> & linage)
+{
+    uint32_t tid = linage[0];
+    taxa.fill_linage(tid, &linage[0]);
+
+    // the taxon of the accession keeps its own rank if it is one of ours
+    taxa_ranks tid_rank = tid == 1 ? intermidiate_lv : taxa.rank_of(tid);
+    if (tid_rank < species_lv || tid_rank > superkingdom_lv)
+        tid_rank = strain_lv;
+    slimm_db.taxid__name[tid] = std::make_tuple(tid_rank, taxa.name_of(tid));
+
+    for (uint32_t r = species_lv; r < LINAGE_LENGTH; ++r)
+    {
+        if (linage[r] != 0)
+            slimm_db.taxid__name[linage[r]] = std::make_tuple(static_cast<taxa_ranks>(r), taxa.name_of(linage[r]));
+    }
+}
+
+// --------------------------------------------------------------------------
+// Function load_taxonomy()
+// --------------------------------------------------------------------------
+inline void load_taxonomy(taxonomy & taxa, arg_options const & options)
+{
+    std::cerr <<"[MSG] loading nodes and names mappings from files ...\n";
+    if (!taxa.load(options.nodes_path, options.names_path))
+    {
+        std::cerr << "[ERROR] Unable to read " << options.nodes_path << " or " << options.names_path << "!\n";
+        exit(1);
+    }
+}
+
 // --------------------------------------------------------------------------
 // Function fill_name_taxid_linage()
 // --------------------------------------------------------------------------
 inline void fill_name_taxid_linage(slimm_database & slimm_db, arg_options const & options)
 {
-    std::cerr <<"[MSG] loading nodes and names mappings from files ...\n";
-    std::unordered_map<uint32_t, std::tuple<taxa_ranks, uint32_t> > taxid__parent;
-    std::unordered_map<uint32_t, std::string>                       taxid__name;
+    taxonomy taxa;
+    load_taxonomy(taxa, options);
 
-    std::ifstream taxid__parent_stream(options.nodes_path);
-    std::ifstream taxid__name_stream(options.names_path);
+    std::cerr <<"[MSG] getting taxonomic linages and resolving names ...\n";
+    for(auto ac__taxid_it=slimm_db.ac__taxid.begin(); ac__taxid_it != slimm_db.ac__taxid.end(); ++ac__taxid_it)
+        add_taxonomic_linage(slimm_db, taxa, ac__taxid_it->second);
+}
+
+// --------------------------------------------------------------------------
+// Function setup_update_argument_parser()
+// --------------------------------------------------------------------------
+void setup_update_argument_parser(ArgumentParser & parser, arg_options const & options)
+{
+    setAppName(parser, "slimm_build update");
+    setShortDescription(parser, "adds new references to an existing SLIMM database");
+    setCategory(parser, "Metagenomics");
+
+    setDateAndVersion(parser);
+    addDescription(parser, "Only the accessions that are not in the database yet are mapped to taxa ids. "
+                           "Their linages are taken from the database where their taxa are already known, "
+                           "names.dmp and nodes.dmp are only needed for new taxa.");
+    addUsageLine(parser, "-d \"\\fIOLD.sldb\\fP\" -o \"\\fISLIMM.sldb\\fP\" [\\fIOPTIONS\\fP] \"\\fIFASTA|ACCESSIONS\\fP\" \"\\fIACCESSION2TAXAID\\fP\"  [\\fIACCESSION2TAXAID_2 ...\\fP]");
 
-    uint32_t taxid=0, parent_taxid = 0;
-    std::string line, rank, ignore, name;
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "NEW REFERENCES"));
+    setHelpText(parser, 0, "A multi-fasta file of the new references or a text file with one accession per line.");
 
-    while(std::getline(taxid__parent_stream, line))
+    addArgument(parser, ArgParseArgument(ArgParseArgument::INPUT_FILE, "ACCESSION2TAXAID MAP FILES", true));
+    setHelpText(parser, 1, "one ore more accession to taxa id mapping files dowloaded from ncbi (separated by space.) "
+                           "Plain, gzipped or converted with slimm_build index.");
+
+    addOption(parser, ArgParseOption("d", "database", "The SLIMM database to extend.", ArgParseArgument::INPUT_FILE));
+    setValidValues(parser, "database", ".sldb");
+    setRequired(parser, "database");
+
+    addOption(parser, ArgParseOption("o", "output-file", "The path to the output file (default slimm_db.sldb)",
+                                     ArgParseArgument::OUTPUT_FILE));
+    setValidValues(parser, "output-file", ".sldb");
+    setDefaultValue(parser, "output-file", options.output_path);
+
+    addOption(parser, ArgParseOption("f", "format", "The database format. \\fIv2\\fP is used in place (memory mapped) "
+                                     "by slimm, \\fIv1\\fP is the format of older versions of slimm.",
+                                     ArgParseOption::STRING));
+    setValidValues(parser, "format", "v1 v2");
+    setDefaultValue(parser, "format", options.format);
+
+    addOption(parser, ArgParseOption("nm", "names", "NCBI's names.dmp file, needed for taxa that are not in the database.",
+                             ArgParseArgument::INPUT_FILE));
+
+    addOption(parser, ArgParseOption("nd", "nodes", "NCBI's nodes.dmp file, needed for taxa that are not in the database.",
+                             ArgParseArgument::INPUT_FILE));
+
+    addOption(parser, ArgParseOption("t", "threads", "Number of threads used to scan the FASTA file and the mapping files.",
+                             ArgParseArgument::INTEGER, "INT"));
+    setMinValue(parser, "threads", "1");
+    setDefaultValue(parser, "threads", options.threads);
+
+    addOption(parser, ArgParseOption("v", "verbose", "Enable verbose output."));
+}
+
+// --------------------------------------------------------------------------
+// Function is_accession_list()
+// --------------------------------------------------------------------------
+// anything that does not start with a FASTA header is taken as a list of accessions
+inline bool is_accession_list(std::string const & path)
+{
+    if (is_compressed_file(path))
+        return false;
+    std::ifstream list_stream(path);
+    char first = '>';
+    list_stream >> first;
+    return first != '>';
+}
+
+// --------------------------------------------------------------------------
+// Function get_listed_accessions()
+// --------------------------------------------------------------------------
+inline void get_listed_accessions(std::set<std::string> & accessions, std::string const & list_path)
+{
+    std::cerr <<"[MSG] getting accessions numbers from " << list_path << " ...\n";
+    std::ifstream list_stream(list_path);
+    std::string line;
+    while (std::getline(list_stream, line))
     {
-        std::stringstream   linestream(line);
-        linestream >> taxid;// first column is taxid
-        std::getline(linestream, ignore, '\t'); //skip |
-        std::getline(linestream, ignore, '\t'); //skip |
-        linestream >> parent_taxid; // third column is parent_taxid
-        std::getline(linestream, ignore, '\t'); //skip |
-        std::getline(linestream, ignore, '\t'); //skip |
-        std::getline(linestream, rank, '\t'); //fifth column is rank
-        taxid__parent[taxid] = std::make_tuple(to_taxa_ranks(rank), parent_taxid);
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        accessions.insert(line.substr(first, accession_length(line.data() + first, line.size() - first)));
     }
+}
 
-    taxid__parent_stream.close();
+// --------------------------------------------------------------------------
+// Function update_main()
+// --------------------------------------------------------------------------
+// slimm_build update
+int update_main(int argc, char const ** argv)
+{
+    ArgumentParser parser;
+    arg_options options;
+    setup_update_argument_parser(parser, options);
+
+    ArgumentParser::ParseResult res = parse(parser, argc, argv);
+    if (res != ArgumentParser::PARSE_OK)
+        return res == ArgumentParser::PARSE_ERROR;
+
+    getArgumentValue(options.fasta_path, parser, 0);
+    uint32_t acc__taxaid_count = getArgumentValueCount(parser, 1);
+    options.ac__taxid_paths.resize(acc__taxaid_count);
+    for (uint32_t i = 0; i < acc__taxaid_count; ++i)
+        getArgumentValue(options.ac__taxid_paths[i], parser, 1, i);
+
+    getOptionValue(options.database_path, parser, "database");
+    if (isSet(parser, "output-file"))
+        getOptionValue(options.output_path, parser, "output-file");
+    if (isSet(parser, "format"))
+        getOptionValue(options.format, parser, "format");
+    if (isSet(parser, "names"))
+        getOptionValue(options.names_path, parser, "names");
+    if (isSet(parser, "nodes"))
+        getOptionValue(options.nodes_path, parser, "nodes");
+    if (isSet(parser, "threads"))
+        getOptionValue(options.threads, parser, "threads");
+    if (isSet(parser, "verbose"))
+        options.verbose = true;
+
+    std::set<std::string> accessions;
+    if (is_accession_list(options.fasta_path))
+        get_listed_accessions(accessions, options.fasta_path);
+    else
+        get_accession_numbers(accessions, options);
 
-    while(std::getline(taxid__name_stream, line))
+    std::cerr <<"[MSG] loading the database " << options.database_path << " ...\n";
+    slimm_database slimm_db;
+    load_slimm_database(slimm_db, options.database_path);
+    slimm_db.unmap();
+
+    for (auto ac_it = accessions.begin(); ac_it != accessions.end();)
+    {
+        if (slimm_db.ac__taxid.count(*ac_it) > 0)
+            ac_it = accessions.erase(ac_it);
+        else
+            ++ac_it;
+    }
+    std::cerr <<"[MSG] " << accessions.size() << " accessions are not in the database yet.\n";
+
+    slimm_database new_db;
+    if (!accessions.empty())
+        get_taxid_from_accession(new_db, accessions, options);
+
+    // the rank and linage of every taxon already in the database
+    std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t const *> > known_taxa;
+    slimm_db.for_each_lineage([&known_taxa](uint32_t const * linage)
     {
-        auto pos = line.find("scientific name", 0);
-        if(pos != std::string::npos)
+        for (uint32_t r = 0; r < LINAGE_LENGTH; ++r)
         {
-            std::stringstream   linestream(line);
-            linestream >> taxid;// first column is taxid
-            std::getline(linestream, ignore, '\t'); //skip |
-            std::getline(linestream, ignore, '\t'); //skip |
-            std::getline(linestream, name, '\t'); // 2nd column is name
-            taxid__name[taxid] = name;
+            if (linage[r] != 0)
+                known_taxa.emplace(linage[r], std::make_pair(r, linage));
         }
-    }
-    taxid__name_stream.close();
+    });
 
-    std::cerr <<"[MSG] getting taxonomic linages and resolving names ...\n";
-    for(auto ac__taxid_it=slimm_db.ac__taxid.begin(); ac__taxid_it != slimm_db.ac__taxid.end(); ++ac__taxid_it)
+    std::vector<std::vector<uint32_t> *> unresolved;
+    for (auto & ac_linage : new_db.ac__taxid)
     {
-        uint32_t tid = ac__taxid_it->second[0];
-        slimm_db.taxid__name[tid] = std::make_tuple(strain_lv, taxid__name[tid]);
+        std::vector<uint32_t> & linage = ac_linage.second;
+        auto taxon_it = known_taxa.find(linage[0]);
+        if (taxon_it == known_taxa.end())
+        {
+            unresolved.push_back(&linage);
+            continue;
+        }
+        uint32_t rank = taxon_it->second.first;
+        uint32_t const * known_linage = taxon_it->second.second;
+        for (uint32_t r = std::max<uint32_t>(rank, species_lv); r < LINAGE_LENGTH; ++r)
+            linage[r] = known_linage[r];
+    }
+    std::cerr <<"[MSG] " << new_db.ac__taxid.size() - unresolved.size()
+              << " new accessions belong to taxa already in the database.\n";
 
-        while (tid != 1)
+    if (!unresolved.empty() && !options.nodes_path.empty() && !options.names_path.empty())
+    {
+        taxonomy taxa;
+        load_taxonomy(taxa, options);
+        std::cerr <<"[MSG] getting taxonomic linages of " << unresolved.size() << " accessions ...\n";
+        for (std::vector<uint32_t> * linage : unresolved)
+            add_taxonomic_linage(new_db, taxa, *linage);
+    }
+    else if (!unresolved.empty())
+    {
+        std::cerr <<"[WARNING!] " << unresolved.size() << " new accessions belong to taxa that are not in the database.\n";
+        std::cerr <<"[WARNING!] Their linages are unknown, provide names.dmp and nodes.dmp (-nm, -nd) to resolve them.\n";
+        for (std::vector<uint32_t> * linage : unresolved)
         {
-            auto tid_pos = taxid__parent.find(tid);
-            if(tid_pos == taxid__parent.end())
-                break;
-
-            taxa_ranks current_rank = std::get<0>(tid_pos->second);
-            if (current_rank >= species_lv && current_rank <= superkingdom_lv)
-            {
-                ac__taxid_it->second[current_rank] = tid;
-                slimm_db.taxid__name[tid] = std::make_tuple(current_rank, taxid__name[tid]);
-            }
-            tid = std::get<1>(tid_pos->second);
+            if (slimm_db.taxid__name.count((*linage)[0]) == 0)
+                new_db.taxid__name.emplace((*linage)[0], std::make_tuple(strain_lv, std::string()));
         }
     }
+
+    for (auto & ac_linage : new_db.ac__taxid)
+        slimm_db.ac__taxid[ac_linage.first] = std::move(ac_linage.second);
+    for (auto & taxon : new_db.taxid__name)
+        slimm_db.taxid__name[taxon.first] = std::move(taxon.second);
+
+    if (options.format == "v1")
+        save_slimm_database(slimm_db, options.output_path);
+    else
+        save_slimm_database_v2(slimm_db, options.output_path);
+    std::cerr <<"[MSG] " << slimm_db.accessions_count() << " accessions are written to " << options.output_path << "\n";
+    return 0;
 }
 
 
@@ -353,6 +590,11 @@ inline void fill_name_taxid_linage(slimm_database & slimm_db, arg_options const
 // Program entry point.
 int main(int argc, char const ** argv)
 {
+    if (argc > 1 && std::string(argv[1]) == "index")
+        return index_main(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "update")
+        return update_main(argc - 1, argv + 1);
+
     // Parse the command line.
     ArgumentParser parser;
     arg_options options;
@@ -371,7 +613,10 @@ int main(int argc, char const ** argv)
     // get the taxid from accession numbers
     get_taxid_from_accession(slimm_db, accessions, options);
     fill_name_taxid_linage(slimm_db, options);
-    save_slimm_database(slimm_db, options.output_path);
+    if (options.format == "v1")
+        save_slimm_database(slimm_db, options.output_path);
+    else
+        save_slimm_database_v2(slimm_db, options.output_path);
 
 //
 //    std::vector<uint32_t> tids = slimm_db.ac__taxid["NZ_CP009257.1"];
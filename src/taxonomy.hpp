@@ -0,0 +1,240 @@
+// ==========================================================================
+//    SLIMM - Species Level Identification of Microbes from Metagenomes.
+// ==========================================================================
+// Copyright (c) 2014-2017, Temesgen H. Dadi, FU Berlin
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of Temesgen H. Dadi or the FU Berlin nor the names of
+//       its contributors may be used to endorse or promote products derived
+//       from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL TEMESGEN H. DADI OR THE FU BERLIN BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+// OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+// DAMAGE.
+//
+// ==========================================================================
+// Author: Temesgen H. Dadi <temesgen.dadi@fu-berlin.de>
+
+#ifndef TAXONOMY_H
+#define TAXONOMY_H
+
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <limits>
+
+using namespace seqan;
+
+uint32_t const NO_TAXON                 = std::numeric_limits<uint32_t>::max();
+// ancestries longer than this are taken as broken (a cycle in nodes.dmp)
+uint32_t const MAX_TAXONOMY_DEPTH       = 1024;
+
+// ==========================================================================
+// Classes
+// ==========================================================================
+
+// ----------------------------------------------------------------------------
+// Class taxonomy
+// ----------------------------------------------------------------------------
+// The NCBI taxonomy (nodes.dmp and names.dmp) in arrays indexed by taxid.
+// Lineages are computed once per taxon and shared by all its descendants.
+class taxonomy
+{
+public:
+    bool load(std::string const & nodes_path, std::string const & names_path)
+    {
+        return _load_nodes(nodes_path) && _load_names(names_path);
+    }
+
+    inline bool contains(uint32_t const taxid) const
+    {
+        return taxid < _parents.size() && _parents[taxid] != NO_TAXON;
+    }
+
+    // the rank of a taxon as in nodes.dmp, intermidiate_lv for ranks slimm does not use
+    inline taxa_ranks rank_of(uint32_t const taxid) const
+    {
+        return contains(taxid) ? static_cast<taxa_ranks>(_ranks[taxid]) : intermidiate_lv;
+    }
+
+    // the scientific name of a taxon or "" if there is none
+    inline std::string name_of(uint32_t const taxid) const
+    {
+        if (taxid >= _name_offsets.size() || _name_lengths[taxid] == 0)
+            return "";
+        return std::string(_names_file.data() + _name_offsets[taxid], _name_lengths[taxid]);
+    }
+
+    // Fills linage[species_lv .. superkingdom_lv] with the ancestors of taxid
+    // (including itself) at these ranks, 0 where there is none. If there are
+    // several ancestors at a rank the one closest to the root is used. The
+    // root (1) and the ancestors of taxa not in nodes.dmp are not looked at.
+    void fill_linage(uint32_t const taxid, uint32_t * linage)
+    {
+        uint32_t const * row = _lineage_row(taxid);
+        for (uint32_t r = species_lv; r < LINAGE_LENGTH; ++r)
+            linage[r] = row[r];
+    }
+
+private:
+    mapped_file                 _names_file;
+    std::vector<uint32_t>       _parents;
+    std::vector<uint8_t>        _ranks;
+    std::vector<uint64_t>       _name_offsets;
+    std::vector<uint32_t>       _name_lengths;
+    // memoized lineages, rows of LINAGE_LENGTH (rank 0 unused)
+    std::vector<uint32_t>       _row_of;
+    std::vector<uint32_t>       _rows;
+
+    // the fields of a .dmp line are separated by "\t|\t"
+    inline static char const * _next_field(char const * pos, char const * line_end)
+    {
+        char const * separator = static_cast<char const *>(std::memchr(pos, '|', line_end - pos));
+        if (separator == nullptr)
+            return line_end;
+        ++separator;
+        return separator < line_end && *separator == '\t' ? separator + 1 : separator;
+    }
+
+    inline static uint32_t _parse_taxid(char const * pos, char const * line_end)
+    {
+        uint32_t taxid = 0;
+        for (; pos < line_end && *pos >= '0' && *pos <= '9'; ++pos)
+            taxid = taxid * 10 + (*pos - '0');
+        return taxid;
+    }
+
+    inline static size_t _field_length(char const * pos, char const * line_end)
+    {
+        char const * end = static_cast<char const *>(std::memchr(pos, '\t', line_end - pos));
+        return (end == nullptr ? line_end : end) - pos;
+    }
+
+    template <typename TFunctor>
+    inline static void _for_each_line(mapped_file const & file, TFunctor && f)
+    {
+        char const * pos = file.data();
+        char const * end = pos + file.size();
+        while (pos < end)
+        {
+            char const * line_end = static_cast<char const *>(std::memchr(pos, '\n', end - pos));
+            if (line_end == nullptr)
+                line_end = end;
+            f(pos, line_end);
+            pos = line_end + 1;
+        }
+    }
+
+    template <typename TValue>
+    inline static void _grow(std::vector<TValue> & values, uint32_t const taxid, TValue const & empty)
+    {
+        if (taxid >= values.size())
+            values.resize(std::max<size_t>(taxid + 1, values.size() * 2), empty);
+    }
+
+    bool _load_nodes(std::string const & nodes_path)
+    {
+        mapped_file nodes_file;
+        if (!nodes_file.open(nodes_path))
+            return false;
+
+        _for_each_line(nodes_file, [this](char const * pos, char const * line_end)
+        {
+            uint32_t taxid = _parse_taxid(pos, line_end);
+            pos = _next_field(pos, line_end);
+            uint32_t parent_taxid = _parse_taxid(pos, line_end);
+            pos = _next_field(pos, line_end);
+            taxa_ranks rank = to_taxa_ranks(std::string(pos, _field_length(pos, line_end)));
+
+            _grow(_parents, taxid, NO_TAXON);
+            _grow(_ranks, taxid, uint8_t(intermidiate_lv));
+            _parents[taxid] = parent_taxid;
+            _ranks[taxid] = rank;
+        });
+        _row_of.assign(_parents.size(), NO_TAXON);
+        return true;
+    }
+
+    bool _load_names(std::string const & names_path)
+    {
+        if (!_names_file.open(names_path))
+            return false;
+
+        char const * names_begin = _names_file.data();
+        _for_each_line(_names_file, [this, names_begin](char const * pos, char const * line_end)
+        {
+            uint32_t taxid = _parse_taxid(pos, line_end);
+            char const * name = _next_field(pos, line_end);
+            char const * name_class = _next_field(_next_field(name, line_end), line_end);
+            if (_field_length(name_class, line_end) != 15 || std::memcmp(name_class, "scientific name", 15) != 0)
+                return;
+
+            _grow(_name_offsets, taxid, uint64_t(0));
+            _grow(_name_lengths, taxid, uint32_t(0));
+            _name_offsets[taxid] = name - names_begin;
+            _name_lengths[taxid] = _field_length(name, line_end);
+        });
+        return true;
+    }
+
+    // the memoized lineage of a taxon, computed iteratively along its
+    // ancestry down from the first ancestor that is already known
+    uint32_t const * _lineage_row(uint32_t const taxid)
+    {
+        static uint32_t const no_lineage[LINAGE_LENGTH] = {0};
+
+        std::vector<uint32_t> path;
+        uint32_t tid = taxid;
+        while (tid != 1 && contains(tid) && _row_of[tid] == NO_TAXON && path.size() < MAX_TAXONOMY_DEPTH)
+        {
+            path.push_back(tid);
+            tid = _parents[tid];
+        }
+
+        uint32_t ancestor_row = NO_TAXON;
+        if (tid != 1 && contains(tid) && _row_of[tid] != NO_TAXON)
+            ancestor_row = _row_of[tid];
+
+        for (auto it = path.rbegin(); it != path.rend(); ++it)
+        {
+            // the row is copied first, inserting a range of _rows into itself is not allowed
+            uint32_t ancestor_lineage[LINAGE_LENGTH] = {0};
+            if (ancestor_row != NO_TAXON)
+                std::copy(_rows.begin() + ancestor_row * LINAGE_LENGTH,
+                          _rows.begin() + (ancestor_row + 1) * LINAGE_LENGTH, ancestor_lineage);
+            uint32_t row = _rows.size() / LINAGE_LENGTH;
+            _rows.insert(_rows.end(), ancestor_lineage, ancestor_lineage + LINAGE_LENGTH);
+
+            // ancestors closer to the root win on the same rank
+            taxa_ranks rank = static_cast<taxa_ranks>(_ranks[*it]);
+            if (rank >= species_lv && rank <= superkingdom_lv && _rows[row * LINAGE_LENGTH + rank] == 0)
+                _rows[row * LINAGE_LENGTH + rank] = *it;
+
+            _row_of[*it] = row;
+            ancestor_row = row;
+        }
+
+        if (ancestor_row == NO_TAXON)
+            return no_lineage;
+        return &_rows[ancestor_row * LINAGE_LENGTH];
+    }
+};
+
+#endif /* TAXONOMY_H */